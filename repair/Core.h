@@ -21,6 +21,10 @@
 #include <memory>
 #include <stdexcept>
 #include <map>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <initializer_list>
 
 #include <boost/filesystem.hpp>
 
@@ -51,6 +55,13 @@ enum class PatchPrioritization {
 };
 
 
+enum class LocationPrioritization {
+  NONE,     // candidates of the same cost are ordered by location
+  OCHIAI,   // candidates of the same cost are ordered by Ochiai suspiciousness of location
+  TARANTULA // candidates of the same cost are ordered by Tarantula suspiciousness of location
+};
+
+
 struct PatchID {
   unsigned long base;  // 0 is reserved for special purpose
   unsigned long int2;  // 0 means disabled
@@ -107,17 +118,122 @@ const std::string EXPLICIT_BV_CAST_TYPE = "unsigned long";
 const std::string EXPLICIT_PTR_CAST_TYPE = "void";
 
 
+/*
+  Interned string: all symbols with the same content share a single copy that lives until the end of repair,
+  so copying and comparing symbols does not depend on the length of the string
+ */
+class Symbol {
+ public:
+  Symbol(): value(empty()) {}
+  Symbol(const std::string &s): value(intern(s)) {}
+  Symbol(const char *s): value(intern(s)) {}
+
+  const std::string &str() const { return *value; }
+  operator const std::string &() const { return *value; }
+
+  friend bool operator==(const Symbol &a, const Symbol &b) { return a.value == b.value; }
+  friend bool operator!=(const Symbol &a, const Symbol &b) { return a.value != b.value; }
+
+ private:
+  static const std::string *empty();
+  static const std::string *intern(const std::string &s);
+  const std::string *value;
+};
+
+inline std::ostream &operator<<(std::ostream &OS, const Symbol &symbol) {
+  return OS << symbol.str();
+}
+
+
+struct Expression;
+
+/*
+  Arguments are shared between copies of an expression and copied only before modification (copy-on-write),
+  so that substituting a subexpression copies only the nodes on the path to it
+ */
+class ExpressionArgs {
+ public:
+  ExpressionArgs() {}
+  ExpressionArgs(std::initializer_list<Expression> args);
+  ExpressionArgs(std::vector<Expression> args);
+
+  std::size_t size() const;
+  bool empty() const;
+  const Expression &operator[](std::size_t index) const;
+  Expression &operator[](std::size_t index);
+  const Expression *begin() const;
+  const Expression *end() const;
+  Expression *begin();
+  Expression *end();
+
+ private:
+  void detach();
+  std::shared_ptr<std::vector<Expression>> args; // null if there are no arguments
+};
+
+
 //NOTE: instead of designing hierarchy, we put everything into a single node (because of a whim)
 struct Expression {
   NodeKind kind;
   Type type; /* should not be ANY */
   Operator op; /* should be NONE if not of the kind OPERATOR */
-  std::string rawType; /* either integer type (char, unsinged char, unsigned short, ...) or pointer base type */
-  std::string repr; /* 1, 2,... for constants; "x", "y",... for variables; ">=",... for ops */
-  std::vector<Expression> args;
+  Symbol rawType; /* either integer type (char, unsinged char, unsigned short, ...) or pointer base type */
+  Symbol repr; /* 1, 2,... for constants; "x", "y",... for variables; ">=",... for ops */
+  ExpressionArgs args;
 };
 
 
+inline ExpressionArgs::ExpressionArgs(std::initializer_list<Expression> args) {
+  if (args.size() > 0)
+    this->args = std::make_shared<std::vector<Expression>>(args);
+}
+
+inline ExpressionArgs::ExpressionArgs(std::vector<Expression> args) {
+  if (! args.empty())
+    this->args = std::make_shared<std::vector<Expression>>(std::move(args));
+}
+
+inline std::size_t ExpressionArgs::size() const {
+  return args ? args->size() : 0;
+}
+
+inline bool ExpressionArgs::empty() const {
+  return size() == 0;
+}
+
+inline const Expression &ExpressionArgs::operator[](std::size_t index) const {
+  return (*args)[index];
+}
+
+inline Expression &ExpressionArgs::operator[](std::size_t index) {
+  detach();
+  return (*args)[index];
+}
+
+inline const Expression *ExpressionArgs::begin() const {
+  return args ? args->data() : nullptr;
+}
+
+inline const Expression *ExpressionArgs::end() const {
+  return args ? args->data() + args->size() : nullptr;
+}
+
+inline Expression *ExpressionArgs::begin() {
+  detach();
+  return args ? args->data() : nullptr;
+}
+
+inline Expression *ExpressionArgs::end() {
+  detach();
+  return args ? args->data() + args->size() : nullptr;
+}
+
+inline void ExpressionArgs::detach() {
+  if (args && args.use_count() > 1)
+    args = std::make_shared<std::vector<Expression>>(*args);
+}
+
+
 const Expression TRUE_NODE = Expression{ NodeKind::CONSTANT,
                                          Type::BOOLEAN,
                                          Operator::NONE,
@@ -195,6 +311,10 @@ struct SchemaApplication {
   Expression original;
   std::vector<Expression> components;
   std::vector<std::string> completePointeeTypes; // for pointer arithmetic
+  // observed during profiling in increasing order, used only for parameters compared with other expressions
+  // (e.g. "x > p", see CandidateStream); empty means unrestricted
+  std::vector<unsigned long> parameterValues;
+  double suspiciousness; // of the location (see FaultLocalization), higher is explored first among candidates of the same cost
 };
 
 
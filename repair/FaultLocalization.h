@@ -1,22 +1,23 @@
 #pragma once
 
+#include <vector>
 #include <unordered_map>
-#include <unordered_set>
 
-#include "Project.h"
-#include "Util.h"
+#include "Profiler.h"
 
-typedef std::unordered_map<std::string, std::unordered_set<unsigned>> Coverage;
-
-Coverage extractAndSaveCoverage(boost::filesystem::path coverageFile);
 
+/*
+  Scores files by suspiciousness of their profiled locations,
+  using the location-by-test coverage collected by the profiler.
+ */
 class FaultLocalization {
 public:
-  FaultLocalization(const std::vector<std::string> &tests, const TestingFramework &tester);
-  std::vector<boost::filesystem::path> localize(std::vector<boost::filesystem::path> allFiles);
+  FaultLocalization(const Profiler &profiler);
+  // ids of at most numFiles most suspicious files, out of files with positive score
+  std::vector<unsigned> localize(unsigned numFiles);
+  // suspiciousness of each covered location according to the formula
+  std::unordered_map<Location, double> scoreLocations(LocationPrioritization formula);
 
 private:
-  TestingFramework tester;
-  std::vector<std::string> tests;
-  boost::filesystem::path coverageDir;
+  const Profiler &profiler;
 };
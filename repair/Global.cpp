@@ -34,14 +34,22 @@ struct Config cfg = {
   /* removeIntermediateData = */ false,
   /* insertAssignments      = */ true,
   /* addGuards              = */ true,
+  /* maxComponents          = */ 32,
   /* maxConditionParameter  = */ 64,
   /* maxExpressionParameter = */ 1,
+  /* iterativeDeepening     = */ false,
+  /* angelicProbing         = */ false,
   /* valueTEQ               = */ true,
   /* dependencyTEQ          = */ true,
+  /* valueProfiling         = */ true,
   /* testPrioritization     = */ TestPrioritization::MAX_FAILING,
   /* patchPrioritization    = */ PatchPrioritization::SYNTACTIC_DIFF,
+  /* locationPrioritization = */ LocationPrioritization::OCHIAI,
+  /* costBand               = */ 0,
+  /* locationScheduling     = */ false,
+  /* timeBudget             = */ 0,
   /* filesToLocalize        = */ 10,
-  /* useLLVMCov             = */ false,
   /* outputOnePerLocation   = */ false,
-  /* outputTop              = */ 0
+  /* outputTop              = */ 0,
+  /* testJobs               = */ 1
 };
@@ -36,16 +36,24 @@ struct Config {
   bool removeIntermediateData;
   bool insertAssignments;
   bool addGuards;
+  unsigned maxComponents;
   unsigned maxConditionParameter;
   unsigned maxExpressionParameter;
+  bool iterativeDeepening;
+  bool angelicProbing;
   bool valueTEQ;
   bool dependencyTEQ;
+  bool valueProfiling;
   TestPrioritization testPrioritization;
   PatchPrioritization patchPrioritization;
+  LocationPrioritization locationPrioritization;
+  double costBand;
+  bool locationScheduling;
+  unsigned timeBudget;
   unsigned filesToLocalize;
-  bool useLLVMCov;
   bool outputOnePerLocation;
   signed outputTop;
+  unsigned testJobs;
 };
 
 
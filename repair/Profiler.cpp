@@ -17,9 +17,17 @@
 */
 
 #include <string>
+#include <unordered_set>
+#include <algorithm>
 #include <sstream>
 #include <cstdlib>
 #include <sys/wait.h>
+#include <unistd.h>
+
+// for shared memory:
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <boost/filesystem/fstream.hpp>
 
@@ -27,98 +35,252 @@
 
 #include "Util.h"
 #include "Profiler.h"
+#include "Runtime.h"
+#include "Synthesis.h"
 #include "Global.h"
 
 namespace fs = boost::filesystem;
 using std::string;
 using std::vector;
-using std::set;
+using std::pair;
 using std::unordered_map;
 
 
-string locToString(const Location &loc) {
-  std::ostringstream out;
-  out << loc.fileId << " "
-      << loc.beginLine << " "
-      << loc.beginColumn << " "
-      << loc.endLine << " "
-      << loc.endColumn;
-  return out.str();
-}
+const unsigned long COVERAGE_WORD_BITS = 8 * sizeof(unsigned long);
 
 
-boost::filesystem::path Profiler::getHeader() {
-  return fs::path(cfg.dataDir) / PROFILE_HEADER_FILE_NAME;
+Profiler::Profiler(unsigned channels):
+  coverageWords(0),
+  valueBits(0),
+  valueWords(0),
+  traceWords(0),
+  anyFailing(false),
+  numTests(0) {
+  for (unsigned channel = 0; channel < std::max(1u, channels); channel++) {
+    std::stringstream name;
+    name << COVERAGE_FILE_NAME << "_" << geteuid();
+    if (channel > 0)
+      name << "_" << channel;
+    coverageNames.push_back(name.str());
+    coverage.push_back(nullptr);
+  }
+}
+
+Profiler::~Profiler() {
+  for (unsigned channel = 0; channel < coverage.size(); channel++) {
+    if (coverage[channel]) {
+      munmap(coverage[channel], sizeof(unsigned long) * traceWords);
+      shm_unlink(coverageNames[channel].c_str());
+    }
+  }
 }
 
 boost::filesystem::path Profiler::getSource() {
   return fs::path(cfg.dataDir) / PROFILE_SOURCE_FILE_NAME;
 }
 
+boost::filesystem::path Profiler::getLocations() {
+  return fs::path(cfg.dataDir) / LOCATIONS_FILE_NAME;
+}
+
+static void setBit(vector<unsigned long> &bits, unsigned long index) {
+  if (bits.size() <= index / COVERAGE_WORD_BITS)
+    bits.resize(index / COVERAGE_WORD_BITS + 1, 0);
+  bits[index / COVERAGE_WORD_BITS] |= 1UL << (index % COVERAGE_WORD_BITS);
+}
+
+static bool getBit(const vector<unsigned long> &bits, unsigned long index) {
+  return index / COVERAGE_WORD_BITS < bits.size() &&
+    (bits[index / COVERAGE_WORD_BITS] >> (index % COVERAGE_WORD_BITS)) & 1UL;
+}
+
+/*
+  Related tests of a location are those that cover it;
+  failing tests are placed first (most recently profiled first), then passing tests in the order of profiling.
+ */
 unordered_map<Location, vector<unsigned>> Profiler::getRelatedTestIndexes() {
-  return relatedTestIndexes;
+  unordered_map<Location, vector<unsigned>> result;
+  for (unsigned long w = 0; w < interestingLocations.size(); w++) {
+    unsigned long word = interestingLocations[w];
+    while (word) {
+      unsigned long id = w * COVERAGE_WORD_BITS + __builtin_ctzl(word);
+      word &= word - 1;
+      if (id >= locations.size())
+        continue;
+      const vector<unsigned long> &row = coveringTests[id];
+      vector<unsigned long> failing(row.size()), passing(row.size());
+      unsigned long count = 0;
+      for (unsigned long i = 0; i < row.size(); i++) {
+        unsigned long mask = i < failingTests.size() ? failingTests[i] : 0;
+        failing[i] = row[i] & mask;
+        passing[i] = row[i] & ~mask;
+        count += __builtin_popcountl(row[i]);
+      }
+      vector<unsigned> &tests = result[locations[id]];
+      tests.reserve(count);
+      for (unsigned long i = failing.size(); i-- > 0; ) {
+        while (failing[i]) {
+          unsigned long bit = COVERAGE_WORD_BITS - 1 - __builtin_clzl(failing[i]);
+          failing[i] &= ~(1UL << bit);
+          tests.push_back(i * COVERAGE_WORD_BITS + bit);
+        }
+      }
+      for (unsigned long i = 0; i < passing.size(); i++) {
+        while (passing[i]) {
+          tests.push_back(i * COVERAGE_WORD_BITS + __builtin_ctzl(passing[i]));
+          passing[i] &= passing[i] - 1;
+        }
+      }
+    }
+  }
+  return result;
 }
 
-bool Profiler::compile() {
+bool Profiler::loadLocations() {
+  fs::ifstream infile(getLocations());
+  if (! infile) {
+    BOOST_LOG_TRIVIAL(warning) << "failed to read " << getLocations();
+    return false;
+  }
+  // NOTE: f1x-transform outputs locations of each file consecutively, with indexes 0, 1, ...
+  vector<pair<unsigned long, Location>> indexed;
+  unsigned long maxFileId = 0;
+  string line;
+  while (std::getline(infile, line)) {
+    Location loc;
+    unsigned long index;
+    std::istringstream iss(line);
+    if (! (iss >> loc.fileId >> index >> loc.beginLine >> loc.beginColumn >> loc.endLine >> loc.endColumn))
+      continue;
+    indexed.push_back(std::make_pair(index, loc));
+    maxFileId = std::max(maxFileId, (unsigned long) loc.fileId);
+  }
+  vector<unsigned long> sizes(maxFileId + 1, 0);
+  for (auto &entry : indexed) {
+    sizes[entry.second.fileId] = std::max(sizes[entry.second.fileId], entry.first + 1);
+  }
+  offsets.assign(maxFileId + 1, 0);
+  unsigned long total = 0;
+  for (unsigned long fid = 0; fid <= maxFileId; fid++) {
+    offsets[fid] = total;
+    total += sizes[fid];
+  }
+  locations.assign(total, Location{0, 0, 0, 0, 0});
+  for (auto &entry : indexed) {
+    locations[offsets[entry.second.fileId] + entry.first] = entry.second;
+  }
+  return true;
+}
+
+bool Profiler::mapCoverage() {
+  coverageWords = locations.size() / COVERAGE_WORD_BITS + 1;
+  if (cfg.valueProfiling) {
+    valueBits = std::max(cfg.maxConditionParameter, cfg.maxExpressionParameter) + 1;
+    valueWords = valueBits / COVERAGE_WORD_BITS + 1;
+  }
+  traceWords = coverageWords + locations.size() * valueWords;
+  size_t size = sizeof(unsigned long) * traceWords;
+  for (unsigned channel = 0; channel < coverage.size(); channel++) {
+    const string &name = coverageNames[channel];
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+      BOOST_LOG_TRIVIAL(warning) << "failed to open shared memory " << name;
+      return false;
+    }
+    ftruncate(fd, size);
+    void *mapped = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+      BOOST_LOG_TRIVIAL(warning) << "failed to map shared memory " << name;
+      return false;
+    }
+    coverage[channel] = (unsigned long*) mapped;
+    clearTrace(channel);
+  }
+  coveringTests.assign(locations.size(), vector<unsigned long>());
+  observedValues.assign(locations.size(), vector<unsigned long>(valueWords, 0));
+  return true;
+}
+
+std::map<string, string> Profiler::getEnvironment(unsigned channel) {
+  return std::map<string, string>{{COVERAGE_CHANNEL_VARIABLE, coverageNames[channel]}};
+}
+
+bool Profiler::compile(const vector<std::shared_ptr<SchemaApplication>> &schemaApplications) {
   BOOST_LOG_TRIVIAL(debug) << "compiling profile runtime";
+  if (! loadLocations() || ! mapCoverage())
+    return false;
+  BOOST_LOG_TRIVIAL(debug) << "number of profiled locations: " << locations.size();
+
   {
     fs::ofstream source(getSource());
-    source << "#include <fstream>" << "\n"
-           << "#include <unordered_set>" << "\n"
-           << "#include \"" << PROFILE_HEADER_FILE_NAME << "\"" << "\n"
-           << "struct __f1x_loc {" << "\n"
-           << "  unsigned long fileId;" << "\n"
-           << "  unsigned long beginLine;" << "\n"
-           << "  unsigned long beginColumn;" << "\n"
-           << "  unsigned long endLine;" << "\n"
-           << "  unsigned long endColumn;" << "\n"
-           << "  bool operator==(const __f1x_loc &other) const {" << "\n"
-           << "return (fileId == other.fileId" << "\n"
-           << "&& beginLine == other.beginLine" << "\n"
-           << "&& beginColumn == other.beginColumn" << "\n"
-           << "&& endLine == other.endLine" << "\n"
-           << "&& endColumn == other.endColumn);" << "\n"
-           << "}" << "\n"
-           << "};" << "\n"
-           << "template <class T>" << "\n"
-           << "inline void hash_combine(std::size_t & s, const T & v)" << "\n"
-           << "{" << "\n"
-           << "std::hash<T> h;" << "\n"
-           << "s ^= h(v) + 0x9e3779b9 + (s << 6) + (s >> 2);" << "\n"
-           << "}" << "\n"
-           << "namespace std {" << "\n"
-           << "template<>" << "\n"
-           << "struct hash<__f1x_loc> {" << "\n"
-           << "inline size_t operator()(const __f1x_loc& id) const {" << "\n"
-           << "size_t value = 0;" << "\n"
-           << "hash_combine(value, id.fileId);" << "\n"
-           << "hash_combine(value, id.beginLine);" << "\n"
-           << "hash_combine(value, id.beginColumn);" << "\n"
-           << "hash_combine(value, id.endLine);" << "\n"
-           << "hash_combine(value, id.endColumn);" << "\n"
-           << "return value;" << "\n"
-           << "}" << "\n"
-           << "};" << "\n"
-           << "}" << "\n"
-           << "std::unordered_set<__f1x_loc> __f1x_locs;" << "\n";
-
-    source << "void __f1x_trace(unsigned long fid, unsigned long bl, unsigned long bc, unsigned long el, unsigned long ec) {"  << "\n"
-           << "__f1x_loc loc = {fid, bl, bc, el, ec};" << "\n"
-           << "if (! __f1x_locs.count(loc)) {" << "\n"
-           << "std::ofstream ofs(\""<< (fs::path(cfg.dataDir) / TRACE_FILE_NAME).string() << "\", std::ofstream::out | std::ofstream::app);" << "\n"
-           << "ofs << fid << \" \" << bl << \" \" <<  bc << \" \" << el << \" \" << ec << \"\\n\";" << "\n"
-           << "__f1x_locs.insert(loc);" << "\n"
-           << "}" << "\n"
+    source << "#include <stdlib.h>" << "\n"
+           << "#include <fcntl.h>" << "\n"
+           << "#include <unistd.h>" << "\n"
+           << "#include <sys/stat.h>" << "\n"
+           << "#include <sys/mman.h>" << "\n"
+           << "#include \"" << RUNTIME_HEADER_FILE_NAME << "\"" << "\n";
+
+    source << "static const unsigned long __f1x_offsets[] = {";
+    for (unsigned long fid = 0; fid < offsets.size(); fid++) {
+      source << (fid ? ", " : "") << offsets[fid];
+    }
+    if (offsets.empty()) {
+      source << "0";
+    }
+    source << "};" << "\n";
+
+    // NOTE: if shared memory is not available (e.g. the test runs under a different user), coverage is discarded
+    source << "static unsigned long __f1x_discarded[" << traceWords << "];" << "\n"
+           << "static unsigned long *__f1x_coverage = 0;" << "\n"
+           << "static void __f1x_init_profile() {" << "\n"
+           << "__f1x_coverage = __f1x_discarded;" << "\n"
+           << "const char *channel = getenv(\"" << COVERAGE_CHANNEL_VARIABLE << "\");" << "\n"
+           << "int fd = shm_open(channel ? channel : \"" << coverageNames[0] << "\", O_RDWR, 0);" << "\n"
+           << "if (fd < 0) return;" << "\n"
+           << "void *mapped = mmap(NULL, sizeof(__f1x_discarded), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);" << "\n"
+           << "close(fd);" << "\n"
+           << "if (mapped != MAP_FAILED) __f1x_coverage = (unsigned long*) mapped;" << "\n"
+           << "}" << "\n";
+
+    source << "static void __f1x_set(unsigned long *bits, unsigned long bit) {" << "\n"
+           << "unsigned long *word = bits + bit / (8 * sizeof(unsigned long));" << "\n"
+           << "unsigned long mask = 1UL << (bit % (8 * sizeof(unsigned long)));" << "\n"
+           << "if (! (*word & mask)) __atomic_fetch_or(word, mask, __ATOMIC_RELAXED);" << "\n"
            << "}" << "\n";
 
-    fs::ofstream header(getHeader());
-    header << "#ifdef __cplusplus" << "\n"
-           << "extern \"C\" {" << "\n"
-           << "#endif" << "\n";
-    header << "void __f1x_trace(unsigned long fid, unsigned long bl, unsigned long bc, unsigned long el, unsigned long ec);\n";
-    header << "#ifdef __cplusplus" << "\n"
-           << "}" << "\n"
-           << "#endif" << "\n";
+    if (cfg.valueProfiling) {
+      source << "static unsigned long __f1x_current = 0;" << "\n"
+             << "static void __f1x_record(long long value) {" << "\n"
+             << "unsigned long *values = __f1x_coverage + " << coverageWords
+             << " + __f1x_current * " << valueWords << ";" << "\n"
+             << "__f1x_set(values, 0);" << "\n"
+             << "if (value < -1 || value > " << valueBits << "LL) return;" << "\n"
+             << "for (long long v = value - 1; v <= value + 1; v++) {" << "\n"
+             << "if (v >= 0 && v < " << valueBits << "LL) __f1x_set(values, v);" << "\n"
+             << "}" << "\n"
+             << "}" << "\n";
+    }
+
+    source << "int __f1x_tracing = 1;" << "\n"
+           << "int __f1x_trace(unsigned long fid, unsigned long idx) {" << "\n"
+           << "if (__f1x_coverage == 0) __f1x_init_profile();" << "\n"
+           << "unsigned long bit = __f1x_offsets[fid] + idx;" << "\n"
+           << "__f1x_set(__f1x_coverage, bit);" << "\n";
+    // NOTE: the call site passes its values to __f1x_observe if __f1x_trace returns non-zero
+    if (cfg.valueProfiling) {
+      source << "__f1x_current = bit;" << "\n"
+             << "return 1;" << "\n";
+    } else {
+      source << "return 0;" << "\n";
+    }
+    source << "}" << "\n";
+
+    if (cfg.valueProfiling) {
+      generateObservingRuntime(schemaApplications, source);
+    } else {
+      generateInactiveRuntime(source);
+    }
   }
   FromDirectory dir(fs::path(cfg.dataDir));
   std::stringstream cmd;
@@ -127,7 +289,8 @@ bool Profiler::compile() {
       << " -fPIC"
       << " " << PROFILE_SOURCE_FILE_NAME
       << " -shared"
-      << " -std=c++11" // this is for initializers
+      << " -lrt" // this is for shared memory
+      << " -std=c++11"
       << " -o libf1xrt.so";
   if (cfg.verbose) {
     cmd << " >&2";
@@ -139,82 +302,95 @@ bool Profiler::compile() {
   return WEXITSTATUS(status) == 0;
 }
 
-void Profiler::clearTrace() {
-  fs::path traceFile = fs::path(cfg.dataDir) / TRACE_FILE_NAME;
-  fs::ofstream out;
-  out.open(traceFile, std::ofstream::out | std::ofstream::trunc);
-  out.close();
-}
-
-void Profiler::mergeTrace(unsigned testIndex, bool isPassing) {
-  fs::path traceFile = fs::path(cfg.dataDir) / TRACE_FILE_NAME;
-  fs::ifstream infile(traceFile);
-  set<string> covered;
-  if(infile) {
-    string line;
-    while (std::getline(infile, line)) {
-      Location loc;
-      std::istringstream iss(line);
-      iss >> loc.fileId >> loc.beginLine >> loc.beginColumn >> loc.endLine >> loc.endColumn;
-      if(! relatedTestIndexes.count(loc)) {
-        relatedTestIndexes[loc] = vector<unsigned>();
-      }
-      vector<unsigned> current = relatedTestIndexes[loc];
-      if (std::find(current.begin(), current.end(), testIndex) == current.end()) {
-        //NOTE: put failing in the beginning, passing in the end
-        if (isPassing)
-          relatedTestIndexes[loc].push_back(testIndex);
-        else
-          relatedTestIndexes[loc].insert(relatedTestIndexes[loc].begin(), testIndex);
+void Profiler::clearTrace(unsigned channel) {
+  if (coverage[channel])
+    std::fill(coverage[channel], coverage[channel] + traceWords, 0UL);
+}
+
+void Profiler::mergeTrace(unsigned testIndex, bool isPassing, unsigned channel) {
+  std::lock_guard<std::mutex> lock(mergeMutex);
+  const unsigned long *trace = coverage[channel];
+  bool empty = true;
+  for (unsigned long w = 0; trace && w < coverageWords; w++) {
+    unsigned long word = trace[w];
+    while (word) {
+      unsigned long id = w * COVERAGE_WORD_BITS + __builtin_ctzl(word);
+      word &= word - 1;
+      if (id >= locations.size())
+        continue;
+      setBit(coveringTests[id], testIndex);
+      const unsigned long *values = trace + coverageWords + id * valueWords;
+      for (unsigned long v = 0; v < valueWords; v++) {
+        observedValues[id][v] |= values[v];
       }
-      covered.insert(locToString(loc));
+      empty = false;
     }
   }
-  if (covered.empty()) {
+  if (empty) {
     BOOST_LOG_TRIVIAL(debug) << "test no. " << testIndex << " produces empty trace";
   }
+  numTests = std::max(numTests, (unsigned long) testIndex + 1);
 
   if (!isPassing) {
-    if (interestingLocations.empty()) {
-      interestingLocations.insert(covered.begin(), covered.end());
+    setBit(failingTests, testIndex);
+    //NOTE: here is intentionally intersection:
+    if (! anyFailing) {
+      interestingLocations.assign(trace, trace + coverageWords);
+      anyFailing = true;
     } else {
-      //NOTE: here is intentionally intersection:
-      set<string> newInteresting;
-      for (auto &loc : interestingLocations) {
-        if (covered.count(loc)) {
-          newInteresting.insert(loc);
-        }
+      for (unsigned long w = 0; w < interestingLocations.size(); w++) {
+        interestingLocations[w] &= trace[w];
       }
-      auto it = relatedTestIndexes.begin();
-      while (it != relatedTestIndexes.end()) {
-        if (! covered.count(locToString(it->first))) {
-          it = relatedTestIndexes.erase(it);
-        } else {
-          it++;
-        }
-      }
-      std::swap(interestingLocations, newInteresting);
     }
   }
 }
 
-fs::path Profiler::getProfile() {
-  fs::path profileFile = fs::path(cfg.dataDir)/ PROFILE_FILE_NAME;
-  fs::ofstream outfile(profileFile, std::ios::app);
+unsigned long Profiler::getNumLocations() const {
+  return locations.size();
+}
 
-  //NOTE: removing uninteresting test indexes
-  unordered_map<Location, vector<unsigned>>::iterator it = relatedTestIndexes.begin();
-  while(it != relatedTestIndexes.end()) {
-    if(interestingLocations.find(locToString(it->first)) == interestingLocations.end()) {
-      it = relatedTestIndexes.erase(it);
-    } else {
-      it++;
-    }
+const Location &Profiler::getLocation(unsigned long id) const {
+  return locations[id];
+}
+
+unsigned long Profiler::countCoveringTests(unsigned long id, bool failing) const {
+  const vector<unsigned long> &row = coveringTests[id];
+  unsigned long count = 0;
+  for (unsigned long i = 0; i < row.size(); i++) {
+    unsigned long mask = i < failingTests.size() ? failingTests[i] : 0;
+    count += __builtin_popcountl(row[i] & (failing ? mask : ~mask));
   }
+  return count;
+}
+
+unsigned long Profiler::countTests(bool failing) const {
+  unsigned long count = 0;
+  for (auto word : failingTests) {
+    count += __builtin_popcountl(word);
+  }
+  return failing ? count : numTests - count;
+}
 
-  for (auto &loc : interestingLocations) {
-    outfile << loc << "\n";
+unordered_map<Location, vector<unsigned long>> Profiler::getParameterValues() const {
+  unordered_map<Location, vector<unsigned long>> result;
+  for (unsigned long id = 0; id < locations.size(); id++) {
+    vector<unsigned long> values;
+    for (unsigned long value = 0; value < valueBits; value++) {
+      if (getBit(observedValues[id], value))
+        values.push_back(value);
+    }
+    // NOTE: no values are recorded if the location is not executed or has no integer values
+    if (! values.empty())
+      result[locations[id]] = values;
   }
+  return result;
+}
 
-  return profileFile;
+void Profiler::selectFiles(const std::vector<unsigned> &fileIds) {
+  std::unordered_set<unsigned> selected(fileIds.begin(), fileIds.end());
+  for (unsigned long id = 0; id < locations.size(); id++) {
+    if (! selected.count(locations[id].fileId) && getBit(interestingLocations, id)) {
+      interestingLocations[id / COVERAGE_WORD_BITS] &= ~(1UL << (id % COVERAGE_WORD_BITS));
+    }
+  }
 }
@@ -19,30 +19,78 @@
 #pragma once
 
 #include <unordered_map>
-#include <set>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <memory>
 
 #include <boost/filesystem.hpp>
 
 #include "Util.h"
 
 
-const std::string TRACE_FILE_NAME          = "trace.txt";
-const std::string PROFILE_FILE_NAME        = "profile.txt";
+const std::string LOCATIONS_FILE_NAME      = "locations.txt";
 const std::string PROFILE_SOURCE_FILE_NAME = "profile.cpp";
-const std::string PROFILE_HEADER_FILE_NAME = "profile.h";
 
+const std::string COVERAGE_FILE_NAME = "/f1x_profile";
+const std::string COVERAGE_CHANNEL_VARIABLE = "F1X_PROFILE_CHANNEL";
 
+
+/*
+  Each profiled location has a dense index within its file assigned by f1x-transform (see LOCATIONS_FILE_NAME).
+  The runtime sets bit (offset of file + index) in a shared memory bitmap, which is read after each test.
+  Concurrently executed tests use different bitmaps (channels), selected through COVERAGE_CHANNEL_VARIABLE.
+  The profiling runtime implements the same interface as the search runtime (see generateRuntimeHeader),
+  so the project is built once and only the runtime library is replaced for search.
+  Unless cfg.valueProfiling is disabled, __f1x_trace also returns 1, so the call site passes its arguments to
+  __f1x_observe, whose function for the location (see generateObservingRuntime) records the values of the original
+  expression and its integer components in a bitmap of the location placed after the coverage bitmap; __f1x_observe
+  returns 0, so the original code is executed as is.
+  Only values that can change the outcome of a parameter are recorded: v - 1, v and v + 1 for each observed value v
+  within the parameter bounds, and 0, which represents all parameter values not adjacent to observed values.
+ */
 class Profiler {
  public:
-  boost::filesystem::path getHeader();
+  Profiler(unsigned channels = 1);
+  ~Profiler();
   boost::filesystem::path getSource();
-  bool compile();
+  boost::filesystem::path getLocations();
+  bool compile(const std::vector<std::shared_ptr<SchemaApplication>> &schemaApplications);
   std::unordered_map<Location, std::vector<unsigned>> getRelatedTestIndexes();
-  boost::filesystem::path getProfile();
-  void mergeTrace(unsigned testIndex, bool isPassing);
-  void clearTrace();
+  std::map<std::string, std::string> getEnvironment(unsigned channel);
+  void mergeTrace(unsigned testIndex, bool isPassing, unsigned channel = 0);
+  void clearTrace(unsigned channel = 0);
+  unsigned long getNumLocations() const;
+  const Location &getLocation(unsigned long id) const;
+  // number of passing/failing tests covering location:
+  unsigned long countCoveringTests(unsigned long id, bool failing) const;
+  // number of profiled passing/failing tests:
+  unsigned long countTests(bool failing) const;
+  // parameter values recorded at each location in increasing order (see SchemaApplication::parameterValues):
+  std::unordered_map<Location, std::vector<unsigned long>> getParameterValues() const;
+  // keeps only locations of given files:
+  void selectFiles(const std::vector<unsigned> &fileIds);
 
  private:
-  std::unordered_map<Location, std::vector<unsigned>> relatedTestIndexes;
-  std::set<std::string> interestingLocations; //NOTE: set of string to make more deterministic
+  bool loadLocations();
+  bool mapCoverage();
+
+  std::vector<Location> locations; // by global index
+  std::vector<unsigned long> offsets; // by file id
+  std::vector<std::string> coverageNames; // by channel
+  std::vector<unsigned long*> coverage; // by channel
+  unsigned long coverageWords;
+  unsigned long valueBits; // parameter values 0, 1, ..., valueBits - 1 are recorded
+  unsigned long valueWords; // per location
+  unsigned long traceWords; // coverage bitmap followed by value bitmaps of all locations
+  std::mutex mergeMutex;
+  // location-by-test bit matrix, rows are indexed by location id, columns by test index:
+  std::vector<std::vector<unsigned long>> coveringTests;
+  std::vector<unsigned long> failingTests;
+  // bit sets of recorded parameter values, by location id:
+  std::vector<std::vector<unsigned long>> observedValues;
+  // bit set of locations covered by all failing tests:
+  std::vector<unsigned long> interestingLocations;
+  bool anyFailing;
+  unsigned long numTests;
 };
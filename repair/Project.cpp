@@ -16,9 +16,15 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <iterator>
 #include <sstream>
 #include <iomanip>
 #include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
 
 #include <boost/filesystem/fstream.hpp>
 #include <boost/log/trivial.hpp>
@@ -134,6 +140,94 @@ void adjustCompileDB() {
 }
 
 
+TransformServer::TransformServer(const std::string &cmd):
+  pid(-1),
+  requests(nullptr),
+  responses(nullptr) {
+  int requestPipe[2];
+  int responsePipe[2];
+  if (pipe(requestPipe) != 0)
+    return;
+  if (pipe(responsePipe) != 0) {
+    close(requestPipe[0]);
+    close(requestPipe[1]);
+    return;
+  }
+
+  pid = fork();
+  if (pid == 0) {
+    dup2(requestPipe[0], STDIN_FILENO);
+    dup2(responsePipe[1], STDOUT_FILENO);
+    close(requestPipe[0]);
+    close(requestPipe[1]);
+    close(responsePipe[0]);
+    close(responsePipe[1]);
+    execl("/bin/sh", "sh", "-c", cmd.c_str(), (char *) NULL);
+    _exit(127);
+  }
+
+  close(requestPipe[0]);
+  close(responsePipe[1]);
+  if (pid < 0) {
+    close(requestPipe[1]);
+    close(responsePipe[0]);
+    return;
+  }
+  // tests and builds must not inherit the pipes, otherwise the server would not see the end of requests
+  fcntl(requestPipe[1], F_SETFD, FD_CLOEXEC);
+  fcntl(responsePipe[0], F_SETFD, FD_CLOEXEC);
+  requests = fdopen(requestPipe[1], "w");
+  responses = fdopen(responsePipe[0], "r");
+}
+
+TransformServer::~TransformServer() {
+  if (requests)
+    fclose(requests);
+  if (responses)
+    fclose(responses);
+  if (pid > 0) {
+    int status;
+    waitpid(pid, &status, 0);
+  }
+}
+
+bool TransformServer::isRunning() {
+  if (pid <= 0 || ! requests || ! responses)
+    return false;
+  int status;
+  if (waitpid(pid, &status, WNOHANG) != 0) {
+    pid = -1;
+    return false;
+  }
+  return true;
+}
+
+bool TransformServer::request(const std::string &line) {
+  if (! isRunning())
+    return false;
+
+  // the server can terminate at any moment (e.g. crash in Clang),
+  // so SIGPIPE is blocked to report this as a failed request
+  sigset_t pipeSignal, oldMask;
+  sigemptyset(&pipeSignal);
+  sigaddset(&pipeSignal, SIGPIPE);
+  pthread_sigmask(SIG_BLOCK, &pipeSignal, &oldMask);
+  bool written = (fprintf(requests, "%s\n", line.c_str()) >= 0) && (fflush(requests) == 0);
+  if (! written) {
+    struct timespec noWait = {0, 0};
+    sigtimedwait(&pipeSignal, NULL, &noWait);
+  }
+  pthread_sigmask(SIG_SETMASK, &oldMask, NULL);
+  if (! written)
+    return false;
+
+  char response[16];
+  if (! fgets(response, sizeof(response), responses))
+    return false;
+  return string(response) == "ok\n";
+}
+
+
 Project::Project(const std::vector<ProjectFile> &files,
                  const std::string &buildCmd):
   files(files),
@@ -241,12 +335,25 @@ void Project::saveFilesWithPrefix(const string &prefix) {
   }
 }
 
+static bool sameContent(const fs::path &a, const fs::path &b) {
+  if (! fs::exists(a) || ! fs::exists(b) || fs::file_size(a) != fs::file_size(b))
+    return false;
+  fs::ifstream as(a, std::ios::binary);
+  fs::ifstream bs(b, std::ios::binary);
+  return std::equal(std::istreambuf_iterator<char>(as), std::istreambuf_iterator<char>(),
+                    std::istreambuf_iterator<char>(bs));
+}
+
+// NOTE: unchanged files are not copied to avoid recompiling them
 void Project::restoreFilesWithPrefix(const string &prefix) {
   for (int i = 0; i < files.size(); i++) {
+    fs::path saved = fs::path(cfg.dataDir) / fs::path(prefix + std::to_string(i) + ".c");
+    if (sameContent(saved, files[i].relpath))
+      continue;
     if(fs::exists(files[i].relpath)) {
       fs::remove(files[i].relpath);
     }
-    fs::copy(fs::path(cfg.dataDir) / fs::path(prefix + std::to_string(i) + ".c"), files[i].relpath);
+    fs::copy(saved, files[i].relpath);
   }
 }
 
@@ -258,10 +365,6 @@ void Project::saveInstrumentedFiles() {
   saveFilesWithPrefix("instrumented");
 }
 
-void Project::saveProfileInstumentedFiles() {
-  saveFilesWithPrefix("profile_instrumented");
-}
-
 
 void Project::restoreOriginalFiles() {
   restoreFilesWithPrefix("original");
@@ -271,19 +374,6 @@ void Project::restoreInstrumentedFiles() {
   restoreFilesWithPrefix("instrumented");
 }
 
-void Project::deleteCoverageFiles() {
-  std::stringstream cmdGcovr;
-  cmdGcovr << "gcovr --delete --xml";
-  if (cfg.useLLVMCov)
-    cmdGcovr << " --gcov-executable=f1x-llvm-cov";
-  cmdGcovr << " >/dev/null 2>&1";
-  BOOST_LOG_TRIVIAL(debug) << "cmd: " << cmdGcovr.str();
-  unsigned long status = std::system(cmdGcovr.str().c_str());
-  if (WEXITSTATUS(status) != 0) {
-    BOOST_LOG_TRIVIAL(warning) << "failed to delete coverage files";
-  }
-}
-
 void Project::computeDiffFinal(const ProjectFile &file,
                           const fs::path &output) {
     {
@@ -320,36 +410,40 @@ void Project::computeDiff(const ProjectFile &file,
   std::system(cmd.c_str());
 }
 
-bool Project::instrumentFile(const ProjectFile &file,
-                             const boost::filesystem::path &outputFile,
-                             const boost::filesystem::path *profile) {
-  unsigned id = getFileId(file);
-
-  std::stringstream cmd;
-  cmd << "f1x-transform " << file.relpath.string();
-  
-  if(! profile) {
-    cmd << " --profile";
-  } else {
-    cmd << " --instrument " << *profile;
-  }
-
-  if(! cfg.addGuards) {
-    cmd << " --disable-guard";
-  }
+bool Project::instrumentFiles(const boost::filesystem::path &applicationsFile,
+                              const boost::filesystem::path &locationsFile) {
+  std::stringstream request;
+  request << "instrument " << applicationsFile.string() << " " << locationsFile.string();
+  return transform(request.str());
+}
 
-  cmd << " --from-line " << file.fromLine
-      << " --to-line " << file.toLine
-      << " --file-id " << id
-      << " --output " + outputFile.string();
-  if (cfg.verbose) {
-    cmd << " >&2";
-  } else {
-    cmd << " >/dev/null 2>&1";
+bool Project::transform(const std::string &request) {
+  if (! transformServer || ! transformServer->isRunning()) {
+    // NOTE: all files are transformed by a single process;
+    // the options below are given once per file in the order of the source list
+    std::stringstream cmd;
+    cmd << "exec f1x-transform --server";
+    for (auto &file : files) {
+      cmd << " " << file.relpath.string();
+    }
+    if(! cfg.addGuards) {
+      cmd << " --disable-guard";
+    }
+    cmd << " --max-components " << cfg.maxComponents;
+    cmd << " --pch-dir " << (fs::path(cfg.dataDir) / "pch").string();
+    for (auto &file : files) {
+      cmd << " --from-line " << file.fromLine
+          << " --to-line " << file.toLine
+          << " --file-id " << getFileId(file);
+    }
+    if (! cfg.verbose) {
+      cmd << " 2>/dev/null";
+    }
+    BOOST_LOG_TRIVIAL(debug) << "cmd: " << cmd.str();
+    transformServer = std::make_shared<TransformServer>(cmd.str());
   }
-  BOOST_LOG_TRIVIAL(debug) << "cmd: " << cmd.str();
-  unsigned long status = std::system(cmd.str().c_str());
-  return WEXITSTATUS(status) == 0;
+  BOOST_LOG_TRIVIAL(debug) << "transformation request: " << request;
+  return transformServer->request(request);
 }
 
 unsigned Project::getFileId(const ProjectFile &file) {
@@ -374,25 +468,7 @@ bool Project::applyPatch(const Patch &patch) {
     unsigned long status = std::system(cmd.c_str());
     success = (WEXITSTATUS(status) == 0);
   } else {
-    unsigned beginLine = patch.app->location.beginLine;
-    unsigned beginColumn = patch.app->location.beginColumn;
-    unsigned endLine = patch.app->location.endLine;
-    unsigned endColumn = patch.app->location.endColumn;
-    std::stringstream cmd;
-    cmd << "f1x-transform " << files[patch.app->location.fileId].relpath.string() << " --apply"
-        << " --bl " << beginLine
-        << " --bc " << beginColumn
-        << " --el " << endLine
-        << " --ec " << endColumn
-        << " --patch " << "\"" << PLACEHOLDER << "\"";
-    if (cfg.verbose) {
-      cmd << " >&2";
-    } else {
-      cmd << " >/dev/null 2>&1";
-    }
-    BOOST_LOG_TRIVIAL(debug) << "cmd: " << cmd.str();
-    unsigned long status = std::system(cmd.str().c_str());
-    success = (WEXITSTATUS(status) == 0);
+    success = applyTemplate(*patch.app);
     saveFilesWithPrefix("patched");
     computeDiff(files[patch.app->location.fileId], patchTemplate);
   }
@@ -401,6 +477,90 @@ bool Project::applyPatch(const Patch &patch) {
   return success;
 }
 
+bool Project::applyTemplate(const SchemaApplication &app) {
+  std::stringstream request;
+  request << "apply " << app.location.fileId
+          << " " << app.location.beginLine
+          << " " << app.location.beginColumn
+          << " " << app.location.endLine
+          << " " << app.location.endColumn
+          << " " << PLACEHOLDER;
+  return transform(request.str());
+}
+
+vector<string> readLines(const fs::path &file) {
+  vector<string> lines;
+  fs::ifstream in(file);
+  string line;
+  while (getline(in, line)) {
+    lines.push_back(line);
+  }
+  return lines;
+}
+
+/*
+  The template differs from the original file only around the placeholder,
+  so the diff is the region between the common prefix and the common suffix.
+ */
+bool Project::makeDiffTemplate(const SchemaApplication &app, DiffTemplate &diff) {
+  unsigned long fileId = app.location.fileId;
+  bool success = applyTemplate(app);
+  vector<string> original = readLines(fs::path(cfg.dataDir) / fs::path("original" + std::to_string(fileId) + ".c"));
+  vector<string> patched = readLines(files[fileId].relpath);
+  restoreOriginalFiles();
+
+  unsigned long prefix = 0;
+  while (prefix < original.size() && prefix < patched.size()
+         && original[prefix] == patched[prefix]) {
+    prefix++;
+  }
+  unsigned long suffix = 0;
+  while (suffix < original.size() - prefix && suffix < patched.size() - prefix
+         && original[original.size() - suffix - 1] == patched[patched.size() - suffix - 1]) {
+    suffix++;
+  }
+
+  diff.relpath = files[fileId].relpath;
+  diff.fromLine = prefix + 1;
+  diff.removed = vector<string>(original.begin() + prefix, original.end() - suffix);
+  diff.added = vector<string>(patched.begin() + prefix, patched.end() - suffix);
+
+  bool hasPlaceholder = false;
+  for (auto &line : diff.added) {
+    if (line.find(PLACEHOLDER) != string::npos)
+      hasPlaceholder = true;
+  }
+  return success && hasPlaceholder;
+}
+
+// follows the hunk header format of "diff -U 0"
+string hunkRange(unsigned long from, unsigned long length) {
+  if (length == 1)
+    return std::to_string(from);
+  if (length == 0)
+    return std::to_string(from - 1) + ",0";
+  return std::to_string(from) + "," + std::to_string(length);
+}
+
+string renderDiff(const DiffTemplate &diff, const string &replacement) {
+  std::ostringstream out;
+  out << "--- " << (fs::path("a") / diff.relpath).string() << "\n"
+      << "+++ " << (fs::path("b") / diff.relpath).string() << "\n"
+      << "@@ -" << hunkRange(diff.fromLine, diff.removed.size())
+      << " +" << hunkRange(diff.fromLine, diff.added.size()) << " @@\n";
+  for (auto &line : diff.removed) {
+    out << "-" << line << "\n";
+  }
+  size_t len = PLACEHOLDER.length();
+  for (auto line : diff.added) {
+    size_t pos = line.find(PLACEHOLDER);
+    if (pos != string::npos)
+      line.replace(pos, len, replacement);
+    out << "+" << line << "\n";
+  }
+  return out.str();
+}
+
 vector<fs::path> Project::filesFromCompilationDB() {
   std::vector<fs::path> files;
   fs::path compileDB("compile_commands.json");
@@ -428,6 +588,7 @@ vector<fs::path> Project::filesFromCompilationDB() {
 void Project::setFiles(const std::vector<ProjectFile> &fs) {
   files = fs;
   saveOriginalFiles();
+  transformServer.reset();
 }
 
 
@@ -439,10 +600,31 @@ TestingFramework::TestingFramework(const Project &project,
   testTimeout(testTimeout) {}
 
 
+// single-quoted for the shell, so that values can contain spaces and metacharacters
+static string shellQuote(const string &value) {
+  string quoted = "'";
+  for (char c : value) {
+    if (c == '\'')
+      quoted += "'\\''";
+    else
+      quoted += c;
+  }
+  return quoted + "'";
+}
+
 TestStatus TestingFramework::execute(const std::string &testId) {
-  InEnvironment env(map<string, string>{{"LD_LIBRARY_PATH", cfg.dataDir}});
+  return execute(testId, map<string, string>());
+}
+
+TestStatus TestingFramework::execute(const std::string &testId, const map<string, string> &environment) {
+  map<string, string> env(environment);
+  env["LD_LIBRARY_PATH"] = cfg.dataDir;
   std::stringstream cmd;
-  cmd << "timeout " << std::setprecision(3) << ((double) testTimeout) / 1000.0 << "s"
+  cmd << "env";
+  for (auto &entry : env) {
+    cmd << " " << entry.first << "=" << shellQuote(entry.second);
+  }
+  cmd << " timeout " << std::setprecision(3) << ((double) testTimeout) / 1000.0 << "s"
       << " " << driver.string() << " " << testId;
   if (cfg.verbose) {
     cmd << " >&2";
@@ -18,6 +18,8 @@
 
 #pragma once
 
+#include <cstdio>
+#include <memory>
 #include <boost/filesystem.hpp>
 #include "Util.h"
 
@@ -30,6 +32,37 @@ struct ProjectFile {
 };
 
 
+/* in-memory diff of a single schema application,
+   the modified code is marked with a placeholder */
+struct DiffTemplate {
+  boost::filesystem::path relpath;
+  unsigned long fromLine; // first changed line in the original file
+  std::vector<std::string> removed;
+  std::vector<std::string> added;
+};
+
+
+std::string renderDiff(const DiffTemplate &diff, const std::string &replacement);
+
+
+/* connection to a long-lived f1x-transform process, see f1x-transform --server */
+class TransformServer {
+ public:
+  TransformServer(const std::string &cmd);
+
+  /* closing requests terminates the server */
+  ~TransformServer();
+
+  bool isRunning();
+  bool request(const std::string &line);
+
+ private:
+  int pid;
+  FILE *requests;
+  FILE *responses;
+};
+
+
 class Project {
  public:
   /* project saves original files on creation
@@ -45,18 +78,17 @@ class Project {
   bool buildWithRuntime(const boost::filesystem::path &header);
   void saveOriginalFiles();
   void saveInstrumentedFiles();
-  void saveProfileInstumentedFiles();
   void restoreOriginalFiles();
   void restoreInstrumentedFiles();
-  void deleteCoverageFiles();
   void computeDiff(const ProjectFile &file,
                    const boost::filesystem::path &outputFile);
   void computeDiffFinal(const ProjectFile &file,
                      const boost::filesystem::path &outputFile);
-  bool instrumentFile(const ProjectFile &file,
-                      const boost::filesystem::path &outputFile,
-                      const boost::filesystem::path *profile = nullptr);
+  /* instruments all candidate locations, saves schema applications and locations for profiling */
+  bool instrumentFiles(const boost::filesystem::path &applicationsFile,
+                       const boost::filesystem::path &locationsFile);
   bool applyPatch(const Patch &patch);
+  bool makeDiffTemplate(const SchemaApplication &app, DiffTemplate &diff);
   std::vector<ProjectFile> getFiles() const;
   void setFiles(const std::vector<ProjectFile> &files);
   std::vector<boost::filesystem::path> filesFromCompilationDB();
@@ -65,9 +97,12 @@ class Project {
   std::vector<ProjectFile> files;
   std::string buildCmd;
   boost::filesystem::path patchTemplateDir;
+  std::shared_ptr<TransformServer> transformServer; // started on first transformation of current files
 
   void saveFilesWithPrefix(const std::string &prefix);
   void restoreFilesWithPrefix(const std::string &prefix);
+  bool applyTemplate(const SchemaApplication &app);
+  bool transform(const std::string &request);
   bool buildInEnvironment(const std::map<std::string, std::string> &env, const std::string &baseCmd);
   unsigned getFileId(const ProjectFile &file);
 };
@@ -80,6 +115,8 @@ class TestingFramework {
                    const unsigned long testTimeout);
   
   TestStatus execute(const std::string &testId);
+  // environment is passed to the test command only, so that tests can be executed concurrently:
+  TestStatus execute(const std::string &testId, const std::map<std::string, std::string> &environment);
   bool driverIsOK();
 
  private:
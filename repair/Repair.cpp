@@ -27,6 +27,9 @@
 #include <vector>
 #include <iostream>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
 
 #include <boost/filesystem/fstream.hpp>
 #include <boost/log/trivial.hpp>
@@ -52,31 +55,7 @@ using std::unordered_map;
 using std::unordered_set;
 
 
-const string APPLICATIONS_FILE_PREFIX = "applications";
-
-
-void prioritize(vector<Patch> &searchSpace,
-                unordered_map<PatchID, double> &cost) {
-  std::stable_sort(searchSpace.begin(),
-                   searchSpace.end(),
-                   [&cost](const Patch &a, const Patch &b) -> bool {
-                     return cost[a.id] < cost[b.id];
-                   });
-}
-
-
-//FIXME: this should be a mapping from a patch to a set of patches and should be computed during search space generation
-shared_ptr<unordered_map<unsigned long, unordered_set<PatchID>>> getPartitionable(const std::vector<Patch> &searchSpace) {
-  shared_ptr<unordered_map<unsigned long, unordered_set<PatchID>>> result(new unordered_map<ulong, unordered_set<PatchID>>);
-  for (auto &el : searchSpace) {
-    unsigned long locId = el.app->id;
-    if (! result->count(locId)) {
-      (*result)[locId] = unordered_set<PatchID>();
-    }
-    (*result)[locId].insert(el.id);
-  }
-  return result;
-}
+const string APPLICATIONS_FILE_NAME = "applications.json";
 
 
 bool validatePatch(Project &project,
@@ -118,44 +97,165 @@ bool validatePatch(Project &project,
     return true;
 }
 
-class thread_obj{
-public:
-    void operator()(const ProjectFile &file,
-                    const fs::path &output, const unsigned fileId){
-        {
-            fs::path a = fs::path("a") / file.relpath;
-            fs::path b = fs::path("b") / file.relpath;
-            fs::ofstream ofs(output);
-            ofs << "--- " << a.string() << "\n"
-                << "+++ " << b.string() << "\n";
-        }
+/*
+  Patches are dumped location by location: the main thread renders a diff template
+  for each location (this modifies the source tree, so it is sequential) and generates
+  its candidates in batches, and a fixed pool of workers instantiates the template for
+  every patch of a batch and appends the result to a single archive. The queue between
+  them is bounded, and candidates are generated on demand (see CandidateStream),
+  so the memory does not depend on the search space size.
+ */
+
+const string PATCH_ARCHIVE_FILE_NAME = "patches.diff";
+const string PATCH_INDEX_FILE_NAME = "index.txt";
+const unsigned DUMP_QUEUE_SIZE_PER_WORKER = 2;
+const unsigned DUMP_BATCH_SIZE = 256;
+
+
+struct DumpBatch {
+  DiffTemplate diff;
+  vector<Patch> patches;
+};
+
 
-        fs::path fromFile = fs::path(cfg.dataDir) / fs::path("original" + std::to_string(fileId) + ".c");
-        fs::path toFile = fs::path(cfg.dataDir) / fs::path("patched" + std::to_string(fileId) + ".c");
-        string cmd = "diff -U 0 " + fromFile.string() + " " + toFile.string() + " | awk 'NR > 2 { print }' >> " + output.string();
-        BOOST_LOG_TRIVIAL(debug) << "cmd: " << cmd;
-        std::system(cmd.c_str());
+class PatchDumper {
+ public:
+  PatchDumper(const fs::path &patchOutput,
+              unsigned numWorkers):
+    archive(patchOutput / PATCH_ARCHIVE_FILE_NAME, std::ios::binary),
+    index(patchOutput / PATCH_INDEX_FILE_NAME),
+    maxQueued(numWorkers * DUMP_QUEUE_SIZE_PER_WORKER),
+    finished(false),
+    offset(0),
+    dumped(0) {
+    for (unsigned i = 0; i < numWorkers; i++) {
+      workers.push_back(std::thread(&PatchDumper::work, this));
     }
+  }
+
+  void push(DumpBatch &&batch) {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    notFull.wait(lock, [this]() { return queue.size() < maxQueued; });
+    queue.push(std::move(batch));
+    notEmpty.notify_one();
+  }
+
+  unsigned long finish() {
+    {
+      std::lock_guard<std::mutex> lock(queueMutex);
+      finished = true;
+    }
+    notEmpty.notify_all();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+    return dumped;
+  }
+
+ private:
+  fs::ofstream archive;
+  fs::ofstream index;
+  vector<std::thread> workers;
+
+  std::queue<DumpBatch> queue;
+  unsigned long maxQueued;
+  bool finished;
+  std::mutex queueMutex;
+  std::condition_variable notEmpty;
+  std::condition_variable notFull;
+
+  std::mutex outputMutex;
+  unsigned long offset;
+  unsigned long dumped;
+
+  void work() {
+    while (true) {
+      DumpBatch batch;
+      {
+        std::unique_lock<std::mutex> lock(queueMutex);
+        notEmpty.wait(lock, [this]() { return finished || !queue.empty(); });
+        if (queue.empty())
+          return;
+        batch = std::move(queue.front());
+        queue.pop();
+        notFull.notify_one();
+      }
+
+      string rendered;
+      vector<unsigned long> lengths;
+      for (auto &patch : batch.patches) {
+        string diff = renderDiff(batch.diff, expressionToString(patch.modified));
+        lengths.push_back(diff.size());
+        rendered += diff;
+      }
+
+      std::lock_guard<std::mutex> lock(outputMutex);
+      archive << rendered;
+      for (unsigned long i = 0; i < batch.patches.size(); i++) {
+        const Patch &patch = batch.patches[i];
+        index << dumped << " "
+              << offset << " "
+              << lengths[i] << " "
+              << patch.app->id << " "
+              << visualizePatchID(patch.id) << "\n";
+        offset += lengths[i];
+        dumped++;
+      }
+    }
+  }
 };
 
-void dumpPatches(Project &project,
-                 vector<Patch> &searchSpace,
+
+/*
+  Writes all patches of the stage to PATCH_ARCHIVE_FILE_NAME; each line of PATCH_INDEX_FILE_NAME
+  is "<position in archive> <offset> <length> <app id> <patch id>"; returns the number of dumped patches
+ */
+unsigned long dumpPatches(Project &project,
+                 const vector<shared_ptr<SchemaApplication>> &schemaApplications,
+                 const ExpansionStage &stage,
                  const boost::filesystem::path &patchOutput) {
-    int i = 0;
-    std::vector<std::thread> threads;
-    for (auto &el : searchSpace) {
-        BOOST_LOG_TRIVIAL(info) << "explored count: " << i+1;
-        fs::path patchFile = patchOutput / (std::to_string(i) + "_f1x.patch");
-        unsigned fileId = el.app->location.fileId;
-        project.applyPatch(el);
-        threads.push_back(std::thread(thread_obj(), project.getFiles()[fileId], patchFile, fileId));
-//        project.computeDiffFinal(project.getFiles()[fileId], patchFile, fileId);
-        project.restoreOriginalFiles();
-        i++;
+  unsigned numWorkers = std::max(1u, std::thread::hardware_concurrency());
+  PatchDumper dumper(patchOutput, numWorkers);
+
+  unsigned long baseId = 1; // the same ids as in SearchSpace
+  for (unsigned long i = 0; i < schemaApplications.size(); i++) {
+    auto sa = schemaApplications[i];
+    CandidateStream candidates(sa, stage, nullptr, baseId);
+    baseId = candidates.endBaseId();
+    if (candidates.empty())
+      continue;
+    BOOST_LOG_TRIVIAL(info) << "dumping location " << (i + 1) << "/" << schemaApplications.size();
+    DiffTemplate diff;
+    if (! project.makeDiffTemplate(*sa, diff)) {
+      BOOST_LOG_TRIVIAL(warning) << "failed to render patches for location " << sa->id;
+      continue;
     }
-    for (auto &th : threads) {
-        th.join();
+    while (! candidates.empty()) {
+      DumpBatch batch;
+      batch.diff = diff;
+      while (! candidates.empty() && batch.patches.size() < DUMP_BATCH_SIZE) {
+        batch.patches.push_back(candidates.next());
+      }
+      dumper.push(std::move(batch));
     }
+  }
+
+  unsigned long dumped = dumper.finish();
+  BOOST_LOG_TRIVIAL(info) << "dumped patches: " << dumped;
+  return dumped;
+}
+
+
+// each line is "<cost> <patch>", candidates are written as they are generated
+void dumpSearchSpace(SearchSpace &searchSpace,
+                     const fs::path &file,
+                     const vector<fs::path> &files) {
+  fs::ofstream os(file);
+  while (! searchSpace.empty()) {
+    Patch el = searchSpace.next();
+    os << std::setprecision(3) << syntacticDiff(el) << " "
+       << visualizeElement(el, files[el.app->location.fileId]) << "\n";
+  }
 }
 
 
@@ -179,45 +279,62 @@ RepairStatus repair(Project &project,
     return RepairStatus::ERROR;
   }
 
-  if (project.getFiles().empty()) {
-    BOOST_LOG_TRIVIAL(info) << "localizing suspicious files";
-    FaultLocalization faultLocal(tests,tester);
-    vector<fs::path> allFiles = project.filesFromCompilationDB();
-    vector<fs::path> localized = faultLocal.localize(allFiles);
-    if (localized.size() == 0) {
-      BOOST_LOG_TRIVIAL(warning) << "no files localized";
-      return RepairStatus::FAILURE;
-    }
-    BOOST_LOG_TRIVIAL(info) << "number of localized files: " << localized.size();
-    std::vector<ProjectFile> projectFiles;
-    for (auto &file : localized) {
-      projectFiles.push_back(ProjectFile{file, 0, 0});
+  // NOTE: suspicious files are localized using the profile of all files
+  bool localizeFiles = project.getFiles().empty();
+  if (localizeFiles) {
+    std::vector<ProjectFile> allFiles;
+    for (auto &file : project.filesFromCompilationDB()) {
+      allFiles.push_back(ProjectFile{file, 0, 0});
     }
-    project.setFiles(projectFiles);
+    project.setFiles(allFiles);
   }
 
-  fs::path traceFile = fs::path(cfg.dataDir) / TRACE_FILE_NAME;
+  fs::path saFile = fs::path(cfg.dataDir) / APPLICATIONS_FILE_NAME;
 
-  BOOST_LOG_TRIVIAL(info) << "instrumenting source files for profiling";
-  for (auto &file : project.getFiles()) {
-    bool profileInstSuccess = project.instrumentFile(file, traceFile);
-    if (! profileInstSuccess) {
-      BOOST_LOG_TRIVIAL(warning) << "profiling instrumentation of " << file.relpath << " returned non-zero exit code";
-    }
+  Profiler profiler(cfg.testJobs);
+
+  BOOST_LOG_TRIVIAL(info) << "applying transfomation schemas to source files";
+  bool instrSuccess = project.instrumentFiles(saFile, profiler.getLocations());
+  if (! instrSuccess) {
+    BOOST_LOG_TRIVIAL(warning) << "transformation returned non-zero exit code";
+  }
+  if (! fs::exists(saFile)) {
+    BOOST_LOG_TRIVIAL(error) << "failed to extract candidate locations";
+    return RepairStatus::ERROR;
   }
-  project.saveProfileInstumentedFiles();
 
-  Profiler profiler;
+  project.saveInstrumentedFiles();
+
+  BOOST_LOG_TRIVIAL(debug) << "loading candidate locations";
+  vector<shared_ptr<SchemaApplication>> sas = loadSchemaApplications({ saFile });
 
-  bool profilerBuildSuccess = profiler.compile();
+  BOOST_LOG_TRIVIAL(debug) << "inferring types";
+  for (auto sa : sas) {
+    Type context;
+    if (sa->context == LocationContext::CONDITION)
+      context = Type::BOOLEAN;
+    else
+      context = Type::ANY;
+    sa->original = correctTypes(sa->original, context);
+  }
+
+  Runtime runtime;
+
+  {
+    fs::ofstream oh(runtime.getHeader());
+    generateRuntimeHeader(oh);
+  }
+
+  // NOTE: the project is built once with the profiling runtime, which is later replaced with the search runtime
+  bool profilerBuildSuccess = profiler.compile(sas);
   if (! profilerBuildSuccess) {
     BOOST_LOG_TRIVIAL(error) << "profiler runtime compilation failed";
     return RepairStatus::ERROR;
   }
 
-  bool profileRebuildSucceeded = project.buildWithRuntime(profiler.getHeader());
-  if (! profileRebuildSucceeded) {
-    BOOST_LOG_TRIVIAL(warning) << "compilation with profiler runtime returned non-zero exit code";
+  bool rebuildSucceeded = project.buildWithRuntime(runtime.getHeader());
+  if (! rebuildSucceeded) {
+    BOOST_LOG_TRIVIAL(warning) << "compilation with runtime returned non-zero exit code";
   }
 
   project.restoreOriginalFiles();
@@ -226,10 +343,15 @@ RepairStatus repair(Project &project,
   vector<string> negativeTests;
   unsigned long numPositive = 0;
   unsigned long numNegative = 0;
+  vector<TestStatus> statuses(tests.size());
+  parallelFor(tests.size(), cfg.testJobs, [&](unsigned long i, unsigned worker) {
+    profiler.clearTrace(worker);
+    statuses[i] = tester.execute(tests[i], profiler.getEnvironment(worker));
+    profiler.mergeTrace(i, (statuses[i] == TestStatus::PASS), worker);
+  });
   for (int i = 0; i < tests.size(); i++) {
     auto test = tests[i];
-    profiler.clearTrace();
-    TestStatus status = tester.execute(test);
+    TestStatus status = statuses[i];
     if (status == TestStatus::PASS)
       numPositive++;
     else {
@@ -238,71 +360,65 @@ RepairStatus repair(Project &project,
     }
     if (status == TestStatus::TIMEOUT)
       BOOST_LOG_TRIVIAL(warning) << "test " << test << " timeout during profiling";
-    profiler.mergeTrace(i, (status == TestStatus::PASS));
   }
   if (numNegative == 0) {
     BOOST_LOG_TRIVIAL(error) << "no negative tests";
     return RepairStatus::NO_NEGATIVE_TESTS;
   }
 
+  if (localizeFiles) {
+    BOOST_LOG_TRIVIAL(info) << "localizing suspicious files";
+    FaultLocalization faultLocal(profiler);
+    vector<unsigned> localized = faultLocal.localize(cfg.filesToLocalize);
+    if (localized.size() == 0) {
+      BOOST_LOG_TRIVIAL(warning) << "no files localized";
+      return RepairStatus::FAILURE;
+    }
+    BOOST_LOG_TRIVIAL(info) << "number of localized files: " << localized.size();
+    for (auto fileId : localized) {
+      BOOST_LOG_TRIVIAL(debug) << "localized file: " << project.getFiles()[fileId].relpath.string();
+    }
+    // NOTE: all files remain in the project, because they are already instrumented and built
+    profiler.selectFiles(localized);
+  }
+
   BOOST_LOG_TRIVIAL(info) << "number of positive tests: " << numPositive;
   BOOST_LOG_TRIVIAL(info) << "number of negative tests: " << numNegative;
   BOOST_LOG_TRIVIAL(info) << "negative tests: " << prettyPrintTests(negativeTests);
 
-  if (cfg.patchPrioritization == PatchPrioritization::SEMANTIC_DIFF)
-    project.deleteCoverageFiles();
-
-  fs::path profile = profiler.getProfile();
-
   auto relatedTestIndexes = profiler.getRelatedTestIndexes();
   BOOST_LOG_TRIVIAL(info) << "number of locations: " << relatedTestIndexes.size();
 
-  vector<fs::path> saFiles;
+  // NOTE: candidates are generated only for locations executed by all failing tests (in localized files)
+  vector<shared_ptr<SchemaApplication>> selected;
+  for (auto sa : sas) {
+    if (relatedTestIndexes.count(sa->location))
+      selected.push_back(sa);
+  }
 
-  BOOST_LOG_TRIVIAL(info) << "applying transfomation schemas to source files";
-  for (int i=0; i<project.getFiles().size(); i++) {
-    std::stringstream schemaAppFile;
-    schemaAppFile << APPLICATIONS_FILE_PREFIX << i << ".json";
-    fs::path saFile = fs::path(cfg.dataDir) / schemaAppFile.str();
-    saFiles.push_back(saFile);
-    bool instrSuccess = project.instrumentFile(project.getFiles()[i], saFile, &profile);
-    if (! instrSuccess) {
-      BOOST_LOG_TRIVIAL(warning) << "transformation returned non-zero exit code";
-    }
-    if (! fs::exists(saFile)) {
-      BOOST_LOG_TRIVIAL(error) << "failed to extract candidate locations";
-      return RepairStatus::ERROR;
+  if (cfg.locationPrioritization != LocationPrioritization::NONE) {
+    FaultLocalization faultLocal(profiler);
+    auto suspiciousness = faultLocal.scoreLocations(cfg.locationPrioritization);
+    for (auto sa : selected) {
+      sa->suspiciousness = suspiciousness[sa->location];
     }
   }
 
-  project.saveInstrumentedFiles();
-
-  BOOST_LOG_TRIVIAL(debug) << "loading candidate locations";
-  vector<shared_ptr<SchemaApplication>> sas = loadSchemaApplications(saFiles);
-
-  BOOST_LOG_TRIVIAL(debug) << "inferring types";
-  for (auto sa : sas) {
-    Type context;
-    if (sa->context == LocationContext::CONDITION)
-      context = Type::BOOLEAN;
-    else
-      context = Type::ANY;
-    sa->original = correctTypes(sa->original, context);
+  if (cfg.valueProfiling) {
+    auto parameterValues = profiler.getParameterValues();
+    for (auto sa : selected) {
+      if (parameterValues.count(sa->location))
+        sa->parameterValues = parameterValues[sa->location];
+    }
   }
 
-  vector<Patch> searchSpace;
-
-  Runtime runtime;
-
-  BOOST_LOG_TRIVIAL(info) << "generating search space";
+  BOOST_LOG_TRIVIAL(info) << "generating runtime";
   {
     fs::ofstream os(runtime.getSource());
-    fs::ofstream oh(runtime.getHeader());
-    searchSpace = generateSearchSpace(sas, os, oh);
+    unsigned long removed = generateRuntime(selected, os);
+    BOOST_LOG_TRIVIAL(info) << "equivalent modifications removed: " << removed;
   }
 
-  BOOST_LOG_TRIVIAL(info) << "search space size: " << searchSpace.size();
-
   bool runtimeSuccess = runtime.compile();
 
   if (! runtimeSuccess) {
@@ -310,107 +426,128 @@ RepairStatus repair(Project &project,
     return RepairStatus::ERROR;
   }
 
-  bool rebuildSucceeded = project.buildWithRuntime(runtime.getHeader());
-
-  if (! rebuildSucceeded) {
-    BOOST_LOG_TRIVIAL(warning) << "compilation with runtime returned non-zero exit code";
-  }
-
-  project.restoreOriginalFiles();
-
-  unordered_map<PatchID, double> cost;
-
-  for (auto &el : searchSpace)
-    cost[el.id] = syntacticDiff(el);
+  vector<ExpansionStage> stages = expansionStages();
 
-  BOOST_LOG_TRIVIAL(info) << "prioritizing search space";
-  prioritize(searchSpace, cost);
+  if (cfg.dump || !cfg.searchSpaceFile.empty()) {
+    unsigned long size;
 
     if (cfg.dump) {
-        BOOST_LOG_TRIVIAL(info) << "dumping patches: " << patchOutput;
-        if (! fs::exists(patchOutput)) {
-            fs::create_directory(patchOutput);
-        }
-        dumpPatches(project, searchSpace, patchOutput);
-
-        if (searchSpace.size() > 0)
-            return RepairStatus::SUCCESS;
-        else
-            return RepairStatus::FAILURE;
+      BOOST_LOG_TRIVIAL(info) << "dumping patches: " << patchOutput;
+      if (! fs::exists(patchOutput)) {
+        fs::create_directory(patchOutput);
+      }
+      size = dumpPatches(project, selected, stages.back(), patchOutput);
+    } else {
+      BOOST_LOG_TRIVIAL(info) << "generating search space";
+      SearchSpace candidates(selected, stages.back(), nullptr, {});
+      BOOST_LOG_TRIVIAL(info) << "search space size: " << candidates.size();
+      size = candidates.size();
+
+      auto path = fs::path(cfg.searchSpaceFile);
+      BOOST_LOG_TRIVIAL(info) << "dumping search space: " << path;
+      vector<fs::path> filePaths;
+      for (auto &pFile: project.getFiles())
+        filePaths.push_back(pFile.relpath);
+      // NOTE: candidates are generated in the order of cost
+      dumpSearchSpace(candidates, path, filePaths);
     }
-  if (!cfg.searchSpaceFile.empty()) {
-    auto path = fs::path(cfg.searchSpaceFile);
-    BOOST_LOG_TRIVIAL(info) << "dumping search space: " << path;
-    vector<fs::path> filePaths;
-    for (auto &pFile: project.getFiles())
-      filePaths.push_back(pFile.relpath);
-    dumpSearchSpace(searchSpace, path, filePaths, cost);
-      if (searchSpace.size() > 0)
-          return RepairStatus::SUCCESS;
-      else
-          return RepairStatus::FAILURE;
+
+    if (size > 0)
+      return RepairStatus::SUCCESS;
+    else
+      return RepairStatus::FAILURE;
   }
 
-  SearchEngine engine(tests, tester, runtime, getPartitionable(searchSpace), relatedTestIndexes);
+  SearchEngine engine(tests, tester, runtime, relatedTestIndexes);
+
+  // NOTE: hopeless locations remain in the runtime, so that patch ids do not change
+  unordered_set<AppID> hopeless;
+  if (cfg.angelicProbing) {
+    BOOST_LOG_TRIVIAL(info) << "probing conditions";
+    for (auto sa : selected) {
+      if (sa->context == LocationContext::CONDITION && ! engine.probe(sa, negativeTests))
+        hopeless.insert(sa->id);
+      if (engine.budgetExhausted()) {
+        BOOST_LOG_TRIVIAL(info) << "time budget exhausted, remaining conditions are not probed";
+        break;
+      }
+    }
+    BOOST_LOG_TRIVIAL(info) << "hopeless locations: " << hopeless.size();
+  }
 
-  unsigned long last = 0;
   unordered_set<AppID> fixLocations;
   unordered_set<AppID> moreThanOneFound;
 
   vector<Patch> plausiblePatches;
 
-  // generate plausible patches
-  while (last < searchSpace.size()) {
-    last = engine.findNext(searchSpace, last);
-    if (last == searchSpace.size())
-      break;
+  bool searchFinished = false;
 
-    if (cfg.outputTop && plausiblePatches.size() >= cfg.outputTop) {
-      BOOST_LOG_TRIVIAL(info) << "found enough patches";
-      break;
+  // NOTE: each stage adds candidates only for locations without plausible patches,
+  // candidates of previous stages are not repeated, and the engine keeps their results
+  for (unsigned stage = 0; stage < stages.size() && !searchFinished; stage++) {
+    if (stages.size() > 1) {
+      BOOST_LOG_TRIVIAL(info) << "expanding search space: stage " << (stage + 1) << "/" << stages.size();
+    } else {
+      BOOST_LOG_TRIVIAL(info) << "generating search space";
     }
-
-    Patch patch = searchSpace[last];
-
-    if (!moreThanOneFound.count(patch.app->id) || cfg.verbose) {
-      fs::path relpath = project.getFiles()[patch.app->location.fileId].relpath;
-      if (!fixLocations.count(patch.app->id) || cfg.verbose) {
-        BOOST_LOG_TRIVIAL(info) << "plausible patch: " << visualizeChange(patch)
-                                << " in " << relpath.string() << ":" << patch.app->location.beginLine;
-      } else {
-        BOOST_LOG_TRIVIAL(info) << "more patches found in " << relpath.string() << ":" << patch.app->location.beginLine;
+    const ExpansionStage *previous = (stage > 0 ? &stages[stage - 1] : nullptr);
+    unordered_set<AppID> excluded(hopeless);
+    excluded.insert(fixLocations.begin(), fixLocations.end());
+    SearchSpace searchSpace(selected, stages[stage], previous, excluded);
+
+    BOOST_LOG_TRIVIAL(info) << "search space size: " << searchSpace.size();
+
+    // generate plausible patches
+    Patch patch;
+    while (engine.findNext(searchSpace, patch)) {
+      if (cfg.outputTop && plausiblePatches.size() >= cfg.outputTop) {
+        BOOST_LOG_TRIVIAL(info) << "found enough patches";
+        searchFinished = true;
+        break;
       }
-    }
 
-    //NOTE: if we generate all patches, then just save the current one and apply/validate later;
-    // if we generate a single patch, then validate now and continue search if it fails
-
-    if (! cfg.generateAll) {
-      bool valid = true;
-      if (cfg.validatePatches) {
-          time_t begin, end, duration;
-          time(&begin);
-          validatePatch(project, tester, tests, patch);
-          time(&end);
-          duration = end - begin;
-          BOOST_LOG_TRIVIAL(info) << "validation time: " << float(duration);
+      if (!moreThanOneFound.count(patch.app->id) || cfg.verbose) {
+        fs::path relpath = project.getFiles()[patch.app->location.fileId].relpath;
+        if (!fixLocations.count(patch.app->id) || cfg.verbose) {
+          BOOST_LOG_TRIVIAL(info) << "plausible patch: " << visualizeChange(patch)
+                                  << " in " << relpath.string() << ":" << patch.app->location.beginLine;
+        } else {
+          BOOST_LOG_TRIVIAL(info) << "more patches found in " << relpath.string() << ":" << patch.app->location.beginLine;
+        }
       }
-      if (valid) {
+
+      //NOTE: if we generate all patches, then just save the current one and apply/validate later;
+      // if we generate a single patch, then validate now and continue search if it fails
+
+      if (! cfg.generateAll) {
+        bool valid = true;
+        if (cfg.validatePatches) {
+            time_t begin, end, duration;
+            time(&begin);
+            validatePatch(project, tester, tests, patch);
+            time(&end);
+            duration = end - begin;
+            BOOST_LOG_TRIVIAL(info) << "validation time: " << float(duration);
+        }
+        if (valid) {
+          fixLocations.insert(patch.app->id);
+          plausiblePatches.push_back(patch);
+          searchFinished = true;
+          break;
+        } else {
+          project.restoreInstrumentedFiles();
+          project.buildWithRuntime(runtime.getHeader());
+        }
+      } else {
+        if (fixLocations.count(patch.app->id))
+          moreThanOneFound.insert(patch.app->id);
         fixLocations.insert(patch.app->id);
         plausiblePatches.push_back(patch);
-        break;
-      } else {
-        project.restoreInstrumentedFiles();
-        project.buildWithRuntime(runtime.getHeader());
       }
-    } else {
-      if (fixLocations.count(patch.app->id))
-        moreThanOneFound.insert(patch.app->id);
-      fixLocations.insert(patch.app->id);
-      plausiblePatches.push_back(patch);
     }
 
-    last++;
+    if (engine.budgetExhausted())
+      searchFinished = true;
   }
 
   // validate patches if needed
@@ -448,21 +585,14 @@ RepairStatus repair(Project &project,
   }
 
   if (cfg.patchPrioritization == PatchPrioritization::SEMANTIC_DIFF) {
-    auto coverageSet = engine.getCoverageSet();
-    for (auto &testCoverage : coverageSet) {
-      BOOST_LOG_TRIVIAL(info) << "test: " << testCoverage.first;
-      std::unordered_map<PatchID, std::shared_ptr<Coverage>> patchCoverage = testCoverage.second;
-      for (auto &patch : plausiblePatches) {
-        BOOST_LOG_TRIVIAL(info) << "patch: " << visualizePatchID(patch.id);
-        Coverage coverage = *patchCoverage[patch.id];
-        for (auto &entry : coverage) {
-          BOOST_LOG_TRIVIAL(info) << "file: " << entry.first;
-          for (auto &line : entry.second) {
-            BOOST_LOG_TRIVIAL(info) << "line: " << line;
-          }
-        }
-      }
+    std::unordered_map<PatchID, unsigned long> distance;
+    for (auto &patch : plausiblePatches) {
+      distance[patch.id] = engine.getSemanticDistance(patch.id);
+      BOOST_LOG_TRIVIAL(info) << "patch: " << visualizePatchID(patch.id)
+                              << " semantic distance: " << distance[patch.id];
     }
+    std::stable_sort(plausiblePatches.begin(), plausiblePatches.end(),
+                     [&](const Patch &a, const Patch &b) { return distance[a.id] < distance[b.id]; });
   }
 
   if (plausiblePatches.size() > 0) {
@@ -16,6 +16,7 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
 #include <cstdlib>
 #include <sstream>
 #include <string>
@@ -49,9 +50,36 @@ Runtime::Runtime() {
   ftruncate(fd, size);
   partition = (PatchID*) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED , fd, 0);
   close(fd);
+
+  signature = nullptr;
+  if (cfg.patchPrioritization == PatchPrioritization::SEMANTIC_DIFF) {
+    std::stringstream realSignatureFileName;
+    size_t signatureSize = SIGNATURE_SIZE / 8;
+    realSignatureFileName << SIGNATURE_FILE_NAME << "_" << geteuid();
+    int signatureFd = shm_open(realSignatureFileName.str().c_str(), O_CREAT | O_RDWR,
+                               S_IRUSR | S_IWUSR);
+    ftruncate(signatureFd, signatureSize);
+    signature = (unsigned long*) mmap(NULL, signatureSize, PROT_READ | PROT_WRITE, MAP_SHARED , signatureFd, 0);
+    close(signatureFd);
+    if (signature == MAP_FAILED)
+      signature = nullptr;
+  }
+
+  probedExecutions = nullptr;
+  if (cfg.angelicProbing) {
+    std::stringstream realProbeFileName;
+    realProbeFileName << PROBE_FILE_NAME << "_" << geteuid();
+    int probeFd = shm_open(realProbeFileName.str().c_str(), O_CREAT | O_RDWR,
+                           S_IRUSR | S_IWUSR);
+    ftruncate(probeFd, sizeof(unsigned long));
+    probedExecutions = (unsigned long*) mmap(NULL, sizeof(unsigned long), PROT_READ | PROT_WRITE, MAP_SHARED , probeFd, 0);
+    close(probeFd);
+    if (probedExecutions == MAP_FAILED)
+      probedExecutions = nullptr;
+  }
   };
 
-void Runtime::setPartition(std::unordered_set<PatchID> ids) {
+void Runtime::setPartition(const std::unordered_set<PatchID> &ids) {
   assert(ids.size() < MAX_PARTITION_SIZE);
   unsigned long index = 0;
   for (auto &id : ids) {
@@ -79,6 +107,36 @@ unordered_set<PatchID> Runtime::getPartition() {
   return result;
 }
 
+void Runtime::clearSignature() {
+  if (signature)
+    std::fill(signature, signature + SIGNATURE_SIZE / (8 * sizeof(unsigned long)), 0UL);
+}
+
+Signature Runtime::getSignature() {
+  if (! signature)
+    return Signature();
+  return Signature(signature, signature + SIGNATURE_SIZE / (8 * sizeof(unsigned long)));
+}
+
+void Runtime::clearProbedExecutions() {
+  if (probedExecutions)
+    *probedExecutions = 0;
+}
+
+unsigned long Runtime::getProbedExecutions() {
+  return probedExecutions ? *probedExecutions : 0;
+}
+
+unsigned long signatureDistance(const Signature &a, const Signature &b) {
+  unsigned long distance = 0;
+  for (unsigned long i = 0; i < std::max(a.size(), b.size()); i++) {
+    unsigned long x = (i < a.size() ? a[i] : 0);
+    unsigned long y = (i < b.size() ? b[i] : 0);
+    distance += __builtin_popcountl(x ^ y);
+  }
+  return distance;
+}
+
 boost::filesystem::path Runtime::getHeader() {
 return fs::path(cfg.dataDir) / RUNTIME_HEADER_FILE_NAME;
 }
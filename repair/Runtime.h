@@ -21,6 +21,7 @@
 #include <unordered_set>
 #include <string>
 #include <sstream>
+#include <vector>
 
 #include <boost/filesystem.hpp>
 
@@ -36,16 +37,34 @@ const std::string PARTITION_FILE_NAME = "/f1x_partition";
 const PatchID INPUT_TERMINATOR = PatchID{0, 0, 0, 0, 0};
 const PatchID OUTPUT_TERMINATOR = PatchID{0, 0, 0, 0, 1};
 
+// execution signature is a bitmap of hashed transitions between executed schema applications:
+const std::string SIGNATURE_FILE_NAME = "/f1x_signature";
+const unsigned long SIGNATURE_SIZE = 1 << 16; // bits
+
+// number of executions of the probed condition (see ProbeKind::COUNT):
+const std::string PROBE_FILE_NAME = "/f1x_probe";
+
+typedef std::vector<unsigned long> Signature;
+
+// number of transitions present in only one of the signatures
+unsigned long signatureDistance(const Signature &a, const Signature &b);
+
 
 class Runtime {
  public:
   Runtime();
-  void setPartition(std::unordered_set<PatchID> ids);
+  void setPartition(const std::unordered_set<PatchID> &ids);
   std::unordered_set<PatchID> getPartition();
+  void clearSignature();
+  Signature getSignature();
+  void clearProbedExecutions();
+  unsigned long getProbedExecutions();
   boost::filesystem::path getSource();
   boost::filesystem::path getHeader();
   bool compile();
 
  private:
   PatchID *partition;
+  unsigned long *signature;
+  unsigned long *probedExecutions;
 };
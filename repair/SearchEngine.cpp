@@ -21,6 +21,7 @@
 #include <sstream>
 #include <memory>
 #include <chrono>
+#include <limits>
 
 #include <boost/log/trivial.hpp>
 
@@ -42,12 +43,10 @@ const unsigned SHOW_PROGRESS_STEP = 10;
 SearchEngine::SearchEngine(const std::vector<std::string> &tests,
                            TestingFramework &tester,
                            Runtime &runtime,
-                           shared_ptr<unordered_map<unsigned long, unordered_set<PatchID>>> partitionable,
                            std::unordered_map<Location, std::vector<unsigned>> relatedTestIndexes):
   tests(tests),
   tester(tester),
   runtime(runtime),
-  partitionable(partitionable),
   relatedTestIndexes(relatedTestIndexes) {
   
   stat.explorationCounter = 0;
@@ -58,6 +57,9 @@ SearchEngine::SearchEngine(const std::vector<std::string> &tests,
 
   progress = 0;
 
+  deadline = std::chrono::steady_clock::now() + std::chrono::seconds(cfg.timeBudget);
+  exhausted = false;
+
   //FIXME: I should use evaluation table instead
   failing = {};
   passing = {};
@@ -65,8 +67,7 @@ SearchEngine::SearchEngine(const std::vector<std::string> &tests,
     passing[test] = {};
   }
 
-  coverageDir = fs::path(cfg.dataDir) / "patch-coverage";
-  fs::create_directory(coverageDir);
+
 
 }
 
@@ -85,8 +86,27 @@ SearchStatistics SearchEngine::getStatistics() {
 }
 
 
-std::unordered_map<std::string, std::unordered_map<PatchID, std::shared_ptr<Coverage>>> SearchEngine::getCoverageSet() {
-  return coverageSet;
+bool SearchEngine::budgetExhausted() const {
+  return exhausted;
+}
+
+
+bool SearchEngine::overBudget() {
+  if (cfg.timeBudget && std::chrono::steady_clock::now() >= deadline)
+    exhausted = true;
+  return exhausted;
+}
+
+
+unsigned long SearchEngine::getSemanticDistance(const PatchID &id) {
+  unsigned long distance = 0;
+  for (auto &testSignatures : signatureSet) {
+    auto signature = testSignatures.second.find(id);
+    if (signature == testSignatures.second.end())
+      continue;
+    distance += signatureDistance(*signature->second, originalSignatures[testSignatures.first]);
+  }
+  return distance;
 }
 
 
@@ -99,15 +119,21 @@ void SearchEngine::prioritizeTest(std::vector<unsigned> &testOrder, unsigned ind
 }
 
 
-unsigned long SearchEngine::findNext(const std::vector<Patch> &searchSpace,
-                                     unsigned long from) {
+bool SearchEngine::findNext(SearchSpace &searchSpace, Patch &result) {
+
+  if (searchSpace.explored() == 0)
+    progress = 0;
+
+  while (! searchSpace.empty()) {
+    if (overBudget()) {
+      BOOST_LOG_TRIVIAL(info) << "time budget exhausted";
+      return false;
+    }
 
-  unsigned long index = from;
-  for (; index < searchSpace.size(); index++) {
     stat.explorationCounter++;
-    showProgress(index, searchSpace.size());
+    showProgress(searchSpace.explored(), searchSpace.size());
 
-    const Patch &elem = searchSpace[index];
+    const Patch elem = searchSpace.next();
 
     if (cfg.valueTEQ) {
       if (failing.count(elem.id))
@@ -122,6 +148,7 @@ unsigned long SearchEngine::findNext(const std::vector<Patch> &searchSpace,
                         { "F1X_ID_PARAM", to_string(elem.id.param) } });
 
     bool passAll = true;
+    double elapsed = 0; // seconds, reported to the scheduler
 
     std::vector<unsigned> testOrder = relatedTestIndexes[elem.app->location];
 
@@ -131,14 +158,29 @@ unsigned long SearchEngine::findNext(const std::vector<Patch> &searchSpace,
       if (cfg.valueTEQ) {
         if (passing[test].count(elem.id))
           continue;
+      }
 
+      if (cfg.patchPrioritization == PatchPrioritization::SEMANTIC_DIFF &&
+          ! originalSignatures.count(test)) {
+        // no schema application has this id, so the original program is executed
+        InEnvironment original({ { "F1X_APP", to_string(std::numeric_limits<unsigned long>::max()) } });
+        runtime.clearSignature();
+        tester.execute(test);
+        originalSignatures[test] = runtime.getSignature();
+      }
+
+      if (cfg.valueTEQ) {
         //FIXME: select only unexplored candidates
-        runtime.setPartition((*partitionable)[elem.app->id]);
+        runtime.setPartition(searchSpace.candidatesOf(elem.app->id));
       }
 
       BOOST_LOG_TRIVIAL(debug) << "executing candidate " << visualizePatchID(elem.id) 
                                << " with test " << test;
 
+      if (cfg.patchPrioritization == PatchPrioritization::SEMANTIC_DIFF) {
+        runtime.clearSignature();
+      }
+
       std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
 
       TestStatus status = tester.execute(test);
@@ -146,6 +188,7 @@ unsigned long SearchEngine::findNext(const std::vector<Patch> &searchSpace,
       std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
 
       stat.executionCounter++;
+      elapsed += std::chrono::duration<double>(end - begin).count();
       if (status != TestStatus::TIMEOUT) {
         stat.nonTimeoutCounter++;
         stat.nonTimeoutTestTime += std::chrono::duration_cast<std::chrono::milliseconds>(end - begin).count();
@@ -167,6 +210,12 @@ unsigned long SearchEngine::findNext(const std::vector<Patch> &searchSpace,
 
       passAll = (status == TestStatus::PASS);
 
+      std::shared_ptr<Signature> signature;
+      if (cfg.patchPrioritization == PatchPrioritization::SEMANTIC_DIFF) {
+        signature = std::make_shared<Signature>(runtime.getSignature());
+        signatureSet[test][elem.id] = signature;
+      }
+
       if (cfg.valueTEQ) {
         unordered_set<PatchID> partition = runtime.getPartition();
         if (partition.empty()) {
@@ -176,16 +225,9 @@ unsigned long SearchEngine::findNext(const std::vector<Patch> &searchSpace,
                                      << " with test " << test;
         }
 
-        if (cfg.patchPrioritization == PatchPrioritization::SEMANTIC_DIFF) {
-          fs::path coverageFile = coverageDir / (test + "_" + std::to_string(index) + ".xml");
-          std::shared_ptr<Coverage> curCoverage(new Coverage(extractAndSaveCoverage(coverageFile)));
-
-          if (!coverageSet.count(test))
-            coverageSet[test] = std::unordered_map<PatchID, std::shared_ptr<Coverage>>();
-
-          coverageSet[test][elem.id] = curCoverage;
+        if (signature) {
           for (auto &id : partition)
-            coverageSet[test][id] = curCoverage;
+            signatureSet[test][id] = signature;
         }
 
         if (passAll) {
@@ -206,10 +248,56 @@ unsigned long SearchEngine::findNext(const std::vector<Patch> &searchSpace,
       }
     }
 
+    searchSpace.reportTime(elem.app->id, elapsed);
+
     if (passAll) {
-      return index;
+      result = elem;
+      return true;
     }
   }
 
-  return index;
+  return false;
+}
+
+
+TestStatus SearchEngine::executeProbe(std::shared_ptr<SchemaApplication> sa, const Probe &probe, const std::string &test) {
+  InEnvironment env({ { "F1X_APP", to_string(sa->id) },
+                      { "F1X_ID_BASE", "0" },
+                      { "F1X_ID_INT2", "0" },
+                      { "F1X_ID_BOOL2", "0" },
+                      { "F1X_ID_COND3", "0" },
+                      { "F1X_ID_PARAM", "0" },
+                      { "F1X_PROBE_KIND", to_string((unsigned long) probe.kind) },
+                      { "F1X_PROBE_EXECUTION", to_string(probe.execution) } });
+
+  BOOST_LOG_TRIVIAL(debug) << "probing " << sa->id << " (" << (unsigned long) probe.kind
+                           << ", " << probe.execution << ") with test " << test;
+
+  TestStatus status = tester.execute(test);
+  stat.executionCounter++;
+  return status;
+}
+
+bool SearchEngine::probe(std::shared_ptr<SchemaApplication> sa, const std::vector<std::string> &failingTests) {
+  for (auto &test : failingTests) {
+    if (overBudget())
+      return true;
+    runtime.clearProbedExecutions();
+    executeProbe(sa, Probe{ ProbeKind::COUNT, 0 }, test);
+    unsigned long executions = runtime.getProbedExecutions();
+    bool passed = false;
+    for (auto &probe : probes(executions)) {
+      // NOTE: the location is kept if it is not completely probed within the budget
+      if (overBudget())
+        return true;
+      if (executeProbe(sa, probe, test) == TestStatus::PASS) {
+        passed = true;
+        break;
+      }
+    }
+    // NOTE: if some executions were not flipped, a candidate may still make the test pass
+    if (!passed && probesComplete(executions))
+      return false;
+  }
+  return true;
 }
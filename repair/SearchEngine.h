@@ -23,10 +23,11 @@
 #include <unordered_map>
 #include <map>
 #include <vector>
+#include <chrono>
 #include "Util.h"
 #include "Project.h"
 #include "Runtime.h"
-#include "FaultLocalization.h"
+#include "Synthesis.h"
 
 
 struct SearchStatistics {
@@ -43,26 +44,38 @@ class SearchEngine {
   SearchEngine(const std::vector<std::string> &tests,
                TestingFramework &tester,
                Runtime &runtime,
-               std::shared_ptr<std::unordered_map<unsigned long, std::unordered_set<PatchID>>> partitionable,
                std::unordered_map<Location, std::vector<unsigned>> relatedTestIndexes);
 
-  unsigned long findNext(const std::vector<Patch> &searchSpace, unsigned long fromIdx);
-  std::unordered_map<std::string, std::unordered_map<PatchID, std::shared_ptr<Coverage>>> getCoverageSet();
+  // takes candidates from the search space until a plausible one is found;
+  // results of explored candidates are kept for subsequent search spaces
+  bool findNext(SearchSpace &searchSpace, Patch &result);
+  // false if some failing test does not pass with any probe of the condition, and each execution was probed (see Probe)
+  bool probe(std::shared_ptr<SchemaApplication> sa, const std::vector<std::string> &failingTests);
+  // sum of signature distances from the original program over tests executed for the patch (or its equivalence class)
+  unsigned long getSemanticDistance(const PatchID &id);
   SearchStatistics getStatistics();
+  // whether the search or probing stopped because of cfg.timeBudget, which is counted from the construction
+  // and shared by probing and the search
+  bool budgetExhausted() const;
   void showProgress(unsigned long current, unsigned long total);
 
  private:
  
   void prioritizeTest(std::vector<unsigned> &testOrder, unsigned index);
+  bool overBudget();
+  TestStatus executeProbe(std::shared_ptr<SchemaApplication> sa, const Probe &probe, const std::string &test);
   std::vector<std::string> tests;
   TestingFramework tester;
   Runtime runtime;
   SearchStatistics stat;
   unsigned long progress;
-  std::shared_ptr<std::unordered_map<unsigned long, std::unordered_set<PatchID>>> partitionable;
+  std::chrono::steady_clock::time_point deadline;
+  bool exhausted;
   std::unordered_set<PatchID> failing;
   std::unordered_map<std::string, std::unordered_set<PatchID>> passing;
-  std::unordered_map<std::string, std::unordered_map<PatchID, std::shared_ptr<Coverage>>> coverageSet;
+  // test -> signature of the original program
+  std::unordered_map<std::string, Signature> originalSignatures;
+  // test -> patch -> signature, shared by patches of the same equivalence class
+  std::unordered_map<std::string, std::unordered_map<PatchID, std::shared_ptr<Signature>>> signatureSet;
   std::unordered_map<Location, std::vector<unsigned>> relatedTestIndexes;
-  boost::filesystem::path coverageDir;
 };
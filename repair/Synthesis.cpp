@@ -17,17 +17,20 @@
 */
 
 #include <algorithm>
+#include <cmath>
+#include <limits>
 #include <sstream>
-#include <stack>
 #include <string>
 #include <sys/types.h>
 #include <unistd.h>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "Synthesis.h"
 #include "Runtime.h"
 #include "Typing.h"
 #include "Global.h"
+#include "Prioritization.h"
 
 namespace fs = boost::filesystem;
 
@@ -38,10 +41,15 @@ using std::string;
 using std::shared_ptr;
 using std::unordered_map;
 using std::to_string;
-using std::stack;
 
 
 const string ID_TYPE = "unsigned long";
+
+const unsigned INITIAL_PARAMETER_BOUND = 4;
+const unsigned PARAMETER_BOUND_GROWTH = 4;
+const unsigned long PROBE_FLIPS = 4; // first and last executions flipped when there are too many to flip each of them
+const unsigned long PROBE_ALL_FLIPS_LIMIT = 16; // each execution is flipped if there are at most that many
+const unsigned long PROBE_EXECUTION_LIMIT = 1UL << 20; // probed executions are aborted after that, e.g. in forced loops
 const string PARAMETER_TYPE = ID_TYPE; // because it is passed through ID
 
 
@@ -229,7 +237,193 @@ namespace synthesis {
     return Expression{expr.kind, expr.type, expr.op, expr.rawType, expr.repr, {expr.args[0], subs}};
   }
 
-  vector<Expression> bool2Expressions(const vector<Expression> &components) {
+  /*
+    Canonical form identifies equivalent expressions (it is not used for code generation):
+    arguments of commutative operators are ordered, comparisons are mirrored to order their arguments,
+    comparisons of an expression with itself are replaced with constants (unless they can dereference NULL),
+    and identity arithmetic (x + 0, x * 1, x || 0, ...) is removed
+   */
+
+  bool isConstant(const Expression &expr, const string &repr) {
+    return expr.kind == NodeKind::CONSTANT && expr.repr.str() == repr;
+  }
+
+  bool hasDereference(const Expression &expr) {
+    if (expr.kind == NodeKind::DEREFERENCE)
+      return true;
+    for (auto &arg : expr.args) {
+      if (hasDereference(arg))
+        return true;
+    }
+    return false;
+  }
+
+  // AND and OR are not commutative because of short-circuit evaluation (e.g. p != 0 && p->f > 0)
+  bool isCommutative(const Operator &op) {
+    switch (op) {
+    case Operator::EQ:
+    case Operator::NEQ:
+    case Operator::ADD:
+    case Operator::MUL:
+    case Operator::BV_AND:
+    case Operator::BV_OR:
+    case Operator::BV_XOR:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  Operator mirrorOperator(const Operator &op) {
+    switch (op) {
+    case Operator::LT:
+      return Operator::GT;
+    case Operator::LE:
+      return Operator::GE;
+    case Operator::GT:
+      return Operator::LT;
+    case Operator::GE:
+      return Operator::LE;
+    default:
+      return Operator::NONE;
+    }
+  }
+
+  // the value of a comparison or a logical operation is 0 or 1
+  bool isLogicalValue(const Expression &expr) {
+    switch (expr.op) {
+    case Operator::EQ:
+    case Operator::NEQ:
+    case Operator::LT:
+    case Operator::LE:
+    case Operator::GT:
+    case Operator::GE:
+    case Operator::OR:
+    case Operator::AND:
+    case Operator::NOT:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  Expression canonicalForm(const Expression &expr) {
+    if (expr.args.size() != 2) {
+      if (expr.args.size() == 1) {
+        return substituteArg(expr, canonicalForm(expr.args[0]));
+      }
+      return expr;
+    }
+    Expression left = canonicalForm(expr.args[0]);
+    Expression right = canonicalForm(expr.args[1]);
+    string leftRepr = expressionToString(left);
+    string rightRepr = expressionToString(right);
+
+    switch (expr.op) {
+    case Operator::EQ:
+    case Operator::NEQ:
+    case Operator::LT:
+    case Operator::LE:
+    case Operator::GT:
+    case Operator::GE:
+      if (leftRepr == rightRepr && !hasDereference(left)) {
+        bool reflexive = (expr.op == Operator::EQ || expr.op == Operator::LE || expr.op == Operator::GE);
+        return reflexive ? TRUE_NODE : FALSE_NODE;
+      }
+      break;
+    case Operator::ADD:
+    case Operator::BV_OR:
+    case Operator::BV_XOR:
+      if (isConstant(right, "0"))
+        return left;
+      if (isConstant(left, "0"))
+        return right;
+      break;
+    case Operator::OR:
+      if (isConstant(right, "0") && isLogicalValue(left))
+        return left;
+      if (isConstant(left, "0") && isLogicalValue(right))
+        return right;
+      break;
+    case Operator::SUB:
+    case Operator::BV_SHL:
+    case Operator::BV_SHR:
+      if (isConstant(right, "0"))
+        return left;
+      break;
+    case Operator::MUL:
+      if (isConstant(right, "1"))
+        return left;
+      if (isConstant(left, "1"))
+        return right;
+      break;
+    case Operator::AND:
+      if (isConstant(right, "1") && isLogicalValue(left))
+        return left;
+      if (isConstant(left, "1") && isLogicalValue(right))
+        return right;
+      break;
+    case Operator::DIV:
+      if (isConstant(right, "1"))
+        return left;
+      break;
+    default:
+      break;
+    }
+
+    Expression result = Expression{expr.kind, expr.type, expr.op, expr.rawType, expr.repr, {left, right}};
+    if (leftRepr > rightRepr) {
+      if (isCommutative(expr.op)) {
+        result.args = {right, left};
+      } else if (mirrorOperator(expr.op) != Operator::NONE) {
+        result.op = mirrorOperator(expr.op);
+        result.repr = operatorToString(result.op);
+        result.args = {right, left};
+      }
+    }
+    return result;
+  }
+
+  // keeps the first expression of each equivalence class
+  vector<Expression> uniqueExpressions(const vector<Expression> &expressions, unsigned long &removed) {
+    vector<Expression> result;
+    std::unordered_set<string> seen;
+    for (auto &expr : expressions) {
+      if (seen.insert(expressionToString(canonicalForm(expr))).second) {
+        result.push_back(expr);
+      } else {
+        removed++;
+      }
+    }
+    return result;
+  }
+
+  // keeps the position of the first modification of each equivalence class and the metadata of the closest one;
+  // modifications equivalent to the original expression are removed
+  vector<pair<Expression, PatchMetadata>> uniqueModifications(const Expression &original,
+                                                              const vector<pair<Expression, PatchMetadata>> &modifications,
+                                                              unsigned long &removed) {
+    vector<pair<Expression, PatchMetadata>> result;
+    unordered_map<string, unsigned long> indexByForm;
+    string originalForm = expressionToString(canonicalForm(original));
+    for (auto &modification : modifications) {
+      string form = expressionToString(canonicalForm(modification.first));
+      auto existing = indexByForm.find(form);
+      if (form == originalForm) {
+        removed++;
+      } else if (existing == indexByForm.end()) {
+        indexByForm[form] = result.size();
+        result.push_back(modification);
+      } else {
+        if (modification.second.distance < result[existing->second].second.distance)
+          result[existing->second] = modification;
+        removed++;
+      }
+    }
+    return result;
+  }
+
+  vector<Expression> bool2Expressions(const vector<Expression> &components, unsigned long &removed) {
     vector<Expression> result;
     for (auto &left : components) {
       switch (left.type) {
@@ -265,7 +459,7 @@ namespace synthesis {
         throw std::invalid_argument("unsupported component type");
       }
     }
-    return result;
+    return uniqueExpressions(result, removed);
   }
 
   unsigned long substitutionDistance(const Expression &from, const Expression &to) {
@@ -377,7 +571,8 @@ namespace synthesis {
 
   vector<pair<Expression, PatchMetadata>> baseModifications(const TransformationSchema &schema,
                                                             const Expression &expr,
-                                                            const vector<Expression> &components) {
+                                                            const vector<Expression> &components,
+                                                            unsigned long &removed) {
     vector<pair<Expression, PatchMetadata>> baseModifications;
     auto bool2Meta = PatchMetadata{SynthesisRule::SUBSTITUTION, expressionDepth(BOOL2_NODE)};
     switch (schema) {
@@ -409,7 +604,7 @@ namespace synthesis {
       baseModifications.push_back(make_pair(BOOL2_NODE, bool2Meta)); //TODO: should be COND3
       break;
     }
-    return baseModifications;
+    return uniqueModifications(expr, baseModifications, removed);
   }
 
 }
@@ -420,14 +615,29 @@ namespace generator {
   const string SIZES_ARG_NAME = "__ptr_sizes";
   const string NULLDEREF_ARG_NAME = "__nullderef";
 
+  bool hasNodeOfKind(const Expression &expression, const NodeKind &kind) {
+    if (expression.kind == kind) {
+      return true;
+    } else {
+      for (auto &arg : expression.args) {
+        if(hasNodeOfKind(arg, kind))
+          return true;
+      }
+    }
+    return false;
+  }
+
+  // children are searched through const access, so that only subexpressions that are modified are copied
   void substituteWithRuntimeRepr(Expression &expression,
                                  unordered_map<string, string> &runtimeReprBySource) {
     if (expression.kind == NodeKind::VARIABLE ||
         expression.kind == NodeKind::DEREFERENCE) {
       expression.repr = runtimeReprBySource[expression.repr];
     } else {
-      for (auto &arg : expression.args) {
-        substituteWithRuntimeRepr(arg, runtimeReprBySource);
+      const ExpressionArgs &args = expression.args;
+      for (std::size_t i = 0; i < args.size(); i++) {
+        if (hasNodeOfKind(args[i], NodeKind::VARIABLE) || hasNodeOfKind(args[i], NodeKind::DEREFERENCE))
+          substituteWithRuntimeRepr(expression.args[i], runtimeReprBySource);
       }
     }
   }
@@ -483,9 +693,77 @@ namespace generator {
     OUT << "}" << "\n";
   }
 
+  // forced values of the active condition while probing (see Probe)
+  void prober(std::ostream &OUT) {
+    OUT << "static unsigned long __f1x_env(const char *name) {" << "\n"
+        << "const char *value = getenv(name);" << "\n"
+        << "return value ? strtoul(value, (char **)NULL, 10) : 0;" << "\n"
+        << "}" << "\n"
+        << "unsigned long __f1x_probe_kind = __f1x_env(\"F1X_PROBE_KIND\");" << "\n"
+        << "unsigned long __f1x_probe_execution = __f1x_env(\"F1X_PROBE_EXECUTION\");" << "\n"
+        << "unsigned long __f1x_probe_counter = 0;" << "\n"
+        << "static unsigned long *__f1x_probe_executions = NULL;" << "\n"
+        // NOTE: the maximum number of executions in a process is kept, since executions are counted per process
+        << "static void __f1x_probe_count(unsigned long count) {" << "\n"
+        << "if (__f1x_probe_executions == NULL) {" << "\n"
+        << "static unsigned long discarded;" << "\n"
+        << "__f1x_probe_executions = &discarded;" << "\n"
+        << "int fd = shm_open(\"" << PROBE_FILE_NAME << "_" << geteuid() << "\", O_RDWR, 0);" << "\n"
+        << "if (fd >= 0) {" << "\n"
+        << "void *mapped = mmap(NULL, sizeof(unsigned long), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);" << "\n"
+        << "close(fd);" << "\n"
+        << "if (mapped != MAP_FAILED) __f1x_probe_executions = (unsigned long*) mapped;" << "\n"
+        << "}" << "\n"
+        << "}" << "\n"
+        << "unsigned long seen = __atomic_load_n(__f1x_probe_executions, __ATOMIC_RELAXED);" << "\n"
+        << "while (seen < count && !__atomic_compare_exchange_n(__f1x_probe_executions, &seen, count, false, "
+        << "__ATOMIC_RELAXED, __ATOMIC_RELAXED));" << "\n"
+        << "}" << "\n"
+        << "static bool __f1x_probe(bool original) {" << "\n"
+        << "unsigned long execution = __f1x_probe_counter++;" << "\n"
+        << "if (__f1x_probe_kind == " << (unsigned long) ProbeKind::COUNT << ") {" << "\n"
+        << "__f1x_probe_count(execution + 1);" << "\n"
+        << "return original;" << "\n"
+        << "}" << "\n"
+        << "if (execution >= " << PROBE_EXECUTION_LIMIT << "UL) abort();" << "\n"
+        << "switch (__f1x_probe_kind) {" << "\n"
+        << "case " << (unsigned long) ProbeKind::ALWAYS_FALSE << ": return false;" << "\n"
+        << "case " << (unsigned long) ProbeKind::ALWAYS_TRUE << ": return true;" << "\n"
+        << "case " << (unsigned long) ProbeKind::FLIP_AT << ": return (execution == __f1x_probe_execution) != original;" << "\n"
+        << "case " << (unsigned long) ProbeKind::FLIP_FROM << ": return (execution >= __f1x_probe_execution) != original;" << "\n"
+        << "}" << "\n"
+        << "return original;" << "\n"
+        << "}" << "\n";
+  }
 
-  string parameterList(shared_ptr<SchemaApplication> sa) {
-    std::ostringstream result;
+  // AFL-style transition coverage: bit (previous ^ current) is set on each execution of a schema application
+  void signatureRecorder(std::ostream &OUT) {
+    OUT << "int __f1x_tracing = 1;" << "\n"
+        << "unsigned long *__f1x_signature_map = NULL;" << "\n"
+        << "unsigned long __f1x_signature_previous = 0;" << "\n"
+        << "int __f1x_trace(unsigned long fid, unsigned long idx) {" << "\n"
+        << "if (__f1x_signature_map == NULL) {" << "\n"
+        << "static unsigned long discarded[" << SIGNATURE_SIZE / (8 * sizeof(unsigned long)) << "];" << "\n"
+        << "__f1x_signature_map = discarded;" << "\n"
+        << "int fd = shm_open(\"" << SIGNATURE_FILE_NAME << "_" << geteuid() << "\", O_RDWR, 0);" << "\n"
+        << "if (fd >= 0) {" << "\n"
+        << "void *mapped = mmap(NULL, sizeof(discarded), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);" << "\n"
+        << "close(fd);" << "\n"
+        << "if (mapped != MAP_FAILED) __f1x_signature_map = (unsigned long*) mapped;" << "\n"
+        << "}" << "\n"
+        << "}" << "\n"
+        << "unsigned long current = (((fid << 32) ^ idx) * 0x9E3779B97F4A7C15UL) >> 32;" << "\n"
+        << "unsigned long bit = (current ^ __f1x_signature_previous) % " << SIGNATURE_SIZE << "UL;" << "\n"
+        << "__f1x_signature_map[bit / (8 * sizeof(unsigned long))] |= 1UL << (bit % (8 * sizeof(unsigned long)));" << "\n"
+        << "__f1x_signature_previous = current >> 1;" << "\n"
+        << "return 0;" << "\n"
+        << "}" << "\n";
+  }
+
+  // element types and names of array parameters of the runtime function of sa,
+  // in the order of arrays passed by f1x-transform
+  vector<pair<string, string>> parameters(shared_ptr<SchemaApplication> sa) {
+    vector<pair<string, string>> result;
 
     vector<string> types;
     bool hasPointers = false;
@@ -504,36 +782,86 @@ namespace generator {
 
     std::stable_sort(types.begin(), types.end());
 
-    bool firstArray = true;
     for (auto &type : types) {
-      if (firstArray) {
-        firstArray = false;
-      } else {
-        result << ", ";
-      }
-      result << type << " " << argNameByNonPtrType(type) << "[]";
+      result.push_back(make_pair(type, argNameByNonPtrType(type)));
     }
     if (hasPointers) {
-      if (firstArray) {
-        firstArray = false;
-      } else {
-        result << ", ";
-      }
-      result << "void *" << POINTER_ARG_NAME << "[], ";
-      result << "int " << SIZES_ARG_NAME << "[]";
+      result.push_back(make_pair("void *", POINTER_ARG_NAME));
+      result.push_back(make_pair("int", SIZES_ARG_NAME));
     }
     if (hasDereferences) {
+      result.push_back(make_pair("int", NULLDEREF_ARG_NAME));
+    }
+
+    return result;
+  }
+
+  string outputType(shared_ptr<SchemaApplication> sa) {
+    if (sa->original.type == Type::POINTER) {
+      return "void*";
+    } else {
+      return sa->original.rawType;
+    }
+  }
+
+  string parameterList(shared_ptr<SchemaApplication> sa) {
+    std::ostringstream result;
+    bool firstArray = true;
+    for (auto &parameter : parameters(sa)) {
       if (firstArray) {
         firstArray = false;
       } else {
         result << ", ";
       }
-      result << "int " << NULLDEREF_ARG_NAME << "[]";
+      result << parameter.first << " " << parameter.second << "[]";
+    }
+    return result.str();
+  }
+
+  // arguments of the runtime function of sa from the array of pointers passed by the call site
+  string argumentCasts(shared_ptr<SchemaApplication> sa) {
+    std::ostringstream result;
+    vector<pair<string, string>> params = parameters(sa);
+    for (unsigned i = 0; i < params.size(); i++) {
+      result << (i ? ", " : "") << "(" << params[i].first << "*) args[" << i << "]";
     }
-  
     return result.str();
   }
 
+  /*
+    Call sites pass arguments of all locations in the same way, so that the runtime header does not depend on the search space:
+    __f1x_eval(app, args) calls the runtime function of app with the arrays in args converted back to their types
+   */
+  void dispatcher(const vector<shared_ptr<SchemaApplication>> &schemaApplications,
+                  std::ostream &OUT) {
+    OUT << "unsigned long __f1x_eval(" << ID_TYPE << " app, void *args[]) {" << "\n"
+        << "switch (app) {" << "\n";
+    for (auto sa : schemaApplications) {
+      OUT << "case " << sa->id << "UL: return (unsigned long) __f1x_" << locationNameSuffix(sa->location)
+          << "(" << argumentCasts(sa) << ");" << "\n";
+    }
+    OUT << "}" << "\n"
+        << "abort();" << "\n"
+        << "}" << "\n";
+  }
+
+  /*
+    __f1x_observe(app, args) calls the observing function of app (see observingFunctions) in the same way,
+    and returns 0, so that the call site proceeds with the original code
+  */
+  void observationDispatcher(const vector<shared_ptr<SchemaApplication>> &schemaApplications,
+                             std::ostream &OUT) {
+    OUT << "int __f1x_observe(" << ID_TYPE << " app, void *args[]) {" << "\n"
+        << "switch (app) {" << "\n";
+    for (auto sa : schemaApplications) {
+      OUT << "case " << sa->id << "UL: __f1x_" << locationNameSuffix(sa->location)
+          << "(" << argumentCasts(sa) << "); break;" << "\n";
+    }
+    OUT << "}" << "\n"
+        << "return 0;" << "\n"
+        << "}" << "\n";
+  }
+
 
   unordered_map<string, string> runtimeRenaming(shared_ptr<SchemaApplication> sa) {
     vector<string> nonPtrTypes;
@@ -624,18 +952,49 @@ namespace generator {
   }
 
 
-  bool hasNodeOfKind(const Expression &expression, const NodeKind &kind) {
-    if (expression.kind == kind) {
+  bool isComparison(Operator op) {
+    return op == Operator::EQ || op == Operator::NEQ ||
+           op == Operator::LT || op == Operator::LE ||
+           op == Operator::GT || op == Operator::GE;
+  }
+
+  bool isCast(Operator op) {
+    return op == Operator::IMPLICIT_BV_CAST || op == Operator::IMPLICIT_INT_CAST ||
+           op == Operator::EXPLICIT_BV_CAST || op == Operator::EXPLICIT_INT_CAST ||
+           op == Operator::EXPLICIT_UNSIGNED_CAST;
+  }
+
+  bool isParameterOperand(const Expression &expression) {
+    if (expression.kind == NodeKind::PARAMETER)
       return true;
-    } else {
-      for (auto &arg : expression.args) {
-        if(hasNodeOfKind(arg, kind))
-          return true;
-      }
+    return isCast(expression.op) && expression.args.size() == 1 && isParameterOperand(expression.args[0]);
+  }
+
+  bool dependsOnProgramState(const Expression &expression) {
+    return hasNodeOfKind(expression, NodeKind::VARIABLE) || hasNodeOfKind(expression, NodeKind::DEREFERENCE);
+  }
+
+  // whether each parameter of the expression (possibly under casts) is compared with a variable expression,
+  // e.g. "x > p", but not "p", "p > 3", "x + p > y" or "x > p + 1"
+  bool parametersOnlyCompared(const Expression &expression) {
+    if (isParameterOperand(expression))
+      return false;
+    if (isComparison(expression.op) && expression.args.size() == 2) {
+      bool left = isParameterOperand(expression.args[0]);
+      bool right = isParameterOperand(expression.args[1]);
+      if (left)
+        return dependsOnProgramState(expression.args[1]) && parametersOnlyCompared(expression.args[1]);
+      if (right)
+        return dependsOnProgramState(expression.args[0]) && parametersOnlyCompared(expression.args[0]);
     }
-    return false;
+    for (auto &arg : expression.args) {
+      if (!parametersOnlyCompared(arg))
+        return false;
+    }
+    return true;
   }
 
+  // only the path to the substituted node is detached from the expressions sharing its arguments
   bool substituteNodeOfKind(Expression &expression,
                             NodeKind kind, 
                             const Expression &substitution) {
@@ -643,9 +1002,10 @@ namespace generator {
       expression = substitution;
       return true;
     } else {
-      for (auto &arg : expression.args) {
-        if(substituteNodeOfKind(arg, kind, substitution))
-          return true;
+      const ExpressionArgs &args = expression.args;
+      for (std::size_t i = 0; i < args.size(); i++) {
+        if (hasNodeOfKind(args[i], kind))
+          return substituteNodeOfKind(expression.args[i], kind, substitution);
       }
     }
     return false;
@@ -689,10 +1049,10 @@ namespace generator {
           return expression.repr;
         }
       } else if (expression.args.size() == 1) {
-        return expression.repr + " " + runtimeSemantics(expression.args[0], sizeByType, nullDerefByName);
+        return expression.repr.str() + " " + runtimeSemantics(expression.args[0], sizeByType, nullDerefByName);
       } if (expression.args.size() == 2) {
         return "(" + runtimeSemantics(expression.args[0], sizeByType, nullDerefByName) + " " +
-          expression.repr + " " +
+          expression.repr.str() + " " +
           runtimeSemantics(expression.args[1], sizeByType, nullDerefByName) + ")";
       }
       throw std::invalid_argument("unsupported expression");
@@ -707,27 +1067,20 @@ namespace generator {
   }
 
   void candidateDispatch(shared_ptr<SchemaApplication> sa,
-                                unsigned long &baseId,
-                                std::ostream &OS,
-                                vector<Patch> &ss) {
+                         unsigned long &baseId,
+                         std::ostream &OS,
+                         unsigned long &removed) {
     unordered_map<string, string> runtimeReprBySource = runtimeRenaming(sa);
     unordered_map<string, string> sizeByType = typeSizes(sa);
     unordered_map<string, string> nullDerefByName = nullDerefCondition(sa, runtimeReprBySource);
 
-    unsigned long paramBound;
-    if (sa->context == LocationContext::CONDITION) {
-      paramBound = cfg.maxConditionParameter;
-    } else {
-      paramBound = cfg.maxExpressionParameter;
-    }
-
     OS << "param_value = id.param;" << "\n";
 
     OS << "switch (id.bool2) {" << "\n"
        << "case 0:" << "\n"
        << "break;" << "\n";
     vector<Expression> bool2Expressions =
-      synthesis::bool2Expressions(sa->components);
+      synthesis::bool2Expressions(sa->components, removed);
     for (int i = 0; i < bool2Expressions.size(); i++) {
       Expression runtimeExpr = bool2Expressions[i];
       substituteWithRuntimeRepr(runtimeExpr, runtimeReprBySource);
@@ -738,58 +1091,40 @@ namespace generator {
     OS << "}" << "\n";
 
     vector<pair<Expression, PatchMetadata>> baseModifications =
-      synthesis::baseModifications(sa->schema, sa->original, sa->components);
+      synthesis::baseModifications(sa->schema, sa->original, sa->components, removed);
 
     OS << "switch (id.base) {" << "\n";
 
     for (auto &candidate : baseModifications) {
       Expression runtimeExpr = candidate.first;
-      PatchMetadata metadata = candidate.second;
       substituteWithRuntimeRepr(runtimeExpr, runtimeReprBySource);
 
-      PatchID partialId{0};
-      partialId.base = baseId;
-
-      OS << "case " << partialId.base << ":" << "\n"
+      OS << "case " << baseId << ":" << "\n"
          << "base_value = " << runtimeSemantics(runtimeExpr, sizeByType, nullDerefByName) << ";" << "\n"
          << "break;" << "\n";
-      
-      stack<pair<PatchID, Expression>> parametrizedCandidates;
-      parametrizedCandidates.push(std::make_pair(partialId, candidate.first));
-      
-      while (!parametrizedCandidates.empty()) {
-        pair<PatchID, Expression> current = parametrizedCandidates.top();
-        parametrizedCandidates.pop();
-        if (hasNodeOfKind(current.second, NodeKind::BOOL2)) {
-          for (int i = 0; i < bool2Expressions.size(); i++) {
-            PatchID instanceId = current.first;
-            instanceId.bool2 = i + 1; // 0 means disabled
-            Expression instance = current.second;
-            substituteNodeOfKind(instance, NodeKind::BOOL2, bool2Expressions[i]);
-            parametrizedCandidates.push(std::make_pair(instanceId, instance));
-          }
-        } else if (hasNodeOfKind(current.second, NodeKind::PARAMETER)) {
-          for (int i = 0; i <= paramBound; i++) {
-            PatchID instanceId = current.first;
-            instanceId.param = i;
-            Expression instance = current.second;
-            substituteNodeOfKind(instance, NodeKind::PARAMETER, makeIntegerConst(i));
-            ss.push_back(Patch{instanceId, sa, instance, metadata});
-          }
-        } else {
-          ss.push_back(Patch{current.first, sa, current.second, metadata});
-        }
-      }
-      
+
       baseId++;
     }
 
     OS << "}" << "\n";
   }
 
+  unsigned long parameterBound(shared_ptr<SchemaApplication> sa, const ExpansionStage &stage) {
+    if (sa->context == LocationContext::CONDITION) {
+      return stage.maxConditionParameter;
+    } else {
+      return stage.maxExpressionParameter;
+    }
+  }
+
+  bool isAtomic(const pair<Expression, PatchMetadata> &modification) {
+    return modification.second.distance == synthesis::ATOMIC_EDIT &&
+      !hasNodeOfKind(modification.first, NodeKind::BOOL2);
+  }
+
   void partitioningFunctions(const vector<shared_ptr<SchemaApplication>> &schemaApplications,
                              std::ostream &OS,
-                             vector<Patch> &searchSpace) {
+                             unsigned long &removed) {
 
     OS << "#include \"rt.h\"" << "\n"
        << "#include <stdlib.h>" << "\n"
@@ -803,21 +1138,44 @@ namespace generator {
 
     generator::runtimeLoader(OS);
 
+    generator::prober(OS);
+
+    if (cfg.patchPrioritization == PatchPrioritization::SEMANTIC_DIFF) {
+      generator::signatureRecorder(OS);
+    } else {
+      OS << "int __f1x_tracing = 0;" << "\n"
+         << "int __f1x_trace(unsigned long fid, unsigned long idx) { return 0; }" << "\n";
+    }
+
+    // NOTE: never called, since __f1x_trace of the search runtime returns 0
+    OS << "int __f1x_observe(" << ID_TYPE << " app, void *args[]) { return 0; }" << "\n";
+
     unsigned long baseId = 1; // because 0 is reserved:
 
     for (auto sa : schemaApplications) {
-      string outputType;
-      if (sa->original.type == Type::POINTER) {
-        outputType= "void*";
-      } else {
-        outputType = sa->original.rawType;
-      }
+      string outputType = generator::outputType(sa);
 
-      OS << outputType << " __f1x_"
+      OS << "static " << outputType << " __f1x_"
          << locationNameSuffix(sa->location)
          << "(" << generator::parameterList(sa) << ")"
          << "{" << "\n";
 
+      if (sa->context == LocationContext::CONDITION) {
+        unordered_map<string, string> runtimeReprBySource = runtimeRenaming(sa);
+        unordered_map<string, string> sizeByType = typeSizes(sa);
+        unordered_map<string, string> nullDerefByName = nullDerefCondition(sa, runtimeReprBySource);
+        Expression runtimeExpr = sa->original;
+        substituteWithRuntimeRepr(runtimeExpr, runtimeReprBySource);
+        OS << "if (__f1x_probe_kind) {" << "\n"
+           << "bool current_panic = false;" << "\n"
+           << "bool original_value = " << runtimeSemantics(runtimeExpr, sizeByType, nullDerefByName) << ";" << "\n"
+           << "if (current_panic) {" << "\n"
+           << "abort();" << "\n"
+           << "}" << "\n"
+           << "return __f1x_probe(original_value);" << "\n"
+           << "}" << "\n";
+      }
+
       OS << "__f1xid_t id;" << "\n"
          << "id.base = __f1xid_base;" << "\n"
          << "id.int2 = __f1xid_int2;" << "\n"
@@ -846,7 +1204,7 @@ namespace generator {
 
       OS << "current_panic = false;" << "\n";
 
-      generator::candidateDispatch(sa, baseId, OS, searchSpace);
+      generator::candidateDispatch(sa, baseId, OS, removed);
       
       OS << "if (!output_initialized) {" << "\n"
          << "output_panic = current_panic;" << "\n"
@@ -882,44 +1240,423 @@ namespace generator {
 
   }
 
-}
+  void observingFunctions(const vector<shared_ptr<SchemaApplication>> &schemaApplications,
+                          std::ostream &OS) {
+    for (auto sa : schemaApplications) {
+      string outputType = generator::outputType(sa);
+      unordered_map<string, string> runtimeReprBySource = runtimeRenaming(sa);
+      unordered_map<string, string> sizeByType = typeSizes(sa);
+      unordered_map<string, string> nullDerefByName = nullDerefCondition(sa, runtimeReprBySource);
+
+      OS << "static void __f1x_"
+         << locationNameSuffix(sa->location)
+         << "(" << generator::parameterList(sa) << ")"
+         << "{" << "\n";
 
+      for (auto &c : sa->components) {
+        if (c.type != Type::INTEGER)
+          continue;
+        string runtimeRepr = runtimeReprBySource[c.repr];
+        if (c.kind == NodeKind::DEREFERENCE) {
+          OS << "if (!" << nullDerefByName[runtimeRepr] << ") ";
+        }
+        OS << "__f1x_record((long long) " << runtimeRepr << ");" << "\n";
+      }
+
+      // NOTE: the original expression is evaluated again only to record its value,
+      // the program uses the value computed by the original code
+      if (sa->original.type == Type::INTEGER) {
+        Expression runtimeExpr = sa->original;
+        substituteWithRuntimeRepr(runtimeExpr, runtimeReprBySource);
+        OS << "bool current_panic = false;" << "\n"
+           << outputType << " output_value = " << runtimeSemantics(runtimeExpr, sizeByType, nullDerefByName) << ";" << "\n"
+           << "if (!current_panic) __f1x_record((long long) output_value);" << "\n";
+      }
+
+      OS << "}" << "\n";
+    }
+  }
+
+}
 
-vector<Patch> 
-generateSearchSpace(const vector<shared_ptr<SchemaApplication>> &schemaApplications,
-                    std::ostream &OS,
-                    std::ostream &OH) {
-  
-  // header
 
+void generateRuntimeHeader(std::ostream &OH) {
   OH << "#ifdef __cplusplus" << "\n"
      << "extern \"C\" {" << "\n"
      << "#endif" << "\n"
-     << "extern " << ID_TYPE << " __f1xapp;" << "\n";
+     << "extern " << ID_TYPE << " __f1xapp;" << "\n"
+     << "extern int __f1x_tracing;" << "\n"
+     << "int __f1x_trace(unsigned long fid, unsigned long idx);" << "\n"
+     << "unsigned long __f1x_eval(" << ID_TYPE << " app, void *args[]);" << "\n"
+     << "int __f1x_observe(" << ID_TYPE << " app, void *args[]);" << "\n"
+     << "#ifdef __cplusplus" << "\n"
+     << "}" << "\n"
+     << "#endif" << "\n";
+}
 
-  for (auto sa : schemaApplications) {
-    string outputType;
-    if (sa->original.type == Type::POINTER) {
-      outputType= "void*";
+
+void generateInactiveRuntime(std::ostream &OS) {
+  OS << ID_TYPE << " __f1xapp = " << std::numeric_limits<unsigned long>::max() << "UL;" << "\n"
+     << "unsigned long __f1x_eval(" << ID_TYPE << " app, void *args[]) { abort(); }" << "\n"
+     << "int __f1x_observe(" << ID_TYPE << " app, void *args[]) { return 0; }" << "\n";
+}
+
+
+void generateObservingRuntime(const vector<shared_ptr<SchemaApplication>> &schemaApplications,
+                              std::ostream &OS) {
+  OS << ID_TYPE << " __f1xapp = " << std::numeric_limits<unsigned long>::max() << "UL;" << "\n"
+     << "unsigned long __f1x_eval(" << ID_TYPE << " app, void *args[]) { abort(); }" << "\n";
+
+  generator::observingFunctions(schemaApplications, OS);
+
+  generator::observationDispatcher(schemaApplications, OS);
+}
+
+
+unsigned long generateRuntime(const vector<shared_ptr<SchemaApplication>> &schemaApplications,
+                              std::ostream &OS) {
+  unsigned long removed = 0;
+
+  generator::partitioningFunctions(schemaApplications, OS, removed);
+
+  generator::dispatcher(schemaApplications, OS);
+
+  return removed;
+}
+
+
+bool probesComplete(unsigned long executions) {
+  return executions > 0 && executions <= PROBE_ALL_FLIPS_LIMIT;
+}
+
+vector<Probe> probes(unsigned long executions) {
+  vector<Probe> result;
+  result.push_back(Probe{ ProbeKind::ALWAYS_FALSE, 0 });
+  result.push_back(Probe{ ProbeKind::ALWAYS_TRUE, 0 });
+  vector<unsigned long> flipped;
+  if (executions <= PROBE_ALL_FLIPS_LIMIT) {
+    for (unsigned long execution = 0; execution < executions; execution++) {
+      flipped.push_back(execution);
+    }
+  } else {
+    // NOTE: e.g. off-by-one loop conditions need the last execution flipped
+    for (unsigned long i = 0; i < PROBE_FLIPS; i++) {
+      flipped.push_back(i);
+      flipped.push_back(executions - PROBE_FLIPS + i);
+    }
+    std::sort(flipped.begin(), flipped.end());
+  }
+  for (auto execution : flipped) {
+    result.push_back(Probe{ ProbeKind::FLIP_FROM, execution });
+    result.push_back(Probe{ ProbeKind::FLIP_AT, execution });
+  }
+  return result;
+}
+
+
+vector<ExpansionStage> expansionStages() {
+  vector<ExpansionStage> stages;
+  if (cfg.iterativeDeepening) {
+    unsigned maxBound = std::max(cfg.maxConditionParameter, cfg.maxExpressionParameter);
+    for (unsigned bound = INITIAL_PARAMETER_BOUND; ; bound *= PARAMETER_BOUND_GROWTH) {
+      stages.push_back(ExpansionStage{ true,
+                                       std::min(bound, cfg.maxConditionParameter),
+                                       std::min(bound, cfg.maxExpressionParameter) });
+      if (bound >= maxBound)
+        break;
+    }
+  }
+  stages.push_back(ExpansionStage{ false, cfg.maxConditionParameter, cfg.maxExpressionParameter });
+  return stages;
+}
+
+
+CandidateStream::CandidateStream(shared_ptr<SchemaApplication> sa,
+                                 const ExpansionStage &stage,
+                                 const ExpansionStage *previous,
+                                 unsigned long firstBaseId):
+  sa(sa),
+  count(0) {
+  unsigned long paramBound = generator::parameterBound(sa, stage);
+  for (unsigned long value = 0; value <= paramBound; value++) {
+    allParameters.values.push_back(value);
+  }
+  if (sa->parameterValues.empty()) {
+    comparedParameters.values = allParameters.values;
+  } else {
+    // NOTE: 0 is also the value of candidates without parameters
+    comparedParameters.values.push_back(0);
+    for (auto value : sa->parameterValues) {
+      if (value > 0 && value <= paramBound)
+        comparedParameters.values.push_back(value);
+    }
+  }
+  allParameters.previousCount = 0;
+  comparedParameters.previousCount = 0;
+  if (previous) {
+    unsigned long previousParamBound = generator::parameterBound(sa, *previous);
+    for (ParameterValues *parameters : { &allParameters, &comparedParameters }) {
+      parameters->previousCount = std::upper_bound(parameters->values.begin(),
+                                                   parameters->values.end(),
+                                                   previousParamBound) - parameters->values.begin();
+    }
+  }
+
+  unsigned long removed = 0; // reported by generateRuntime
+
+  vector<pair<Expression, PatchMetadata>> baseModifications =
+    synthesis::baseModifications(sa->schema, sa->original, sa->components, removed);
+
+  // NOTE: base ids are assigned in the same order as in candidateDispatch
+  unsigned long baseId = firstBaseId;
+  bool needBool2 = false;
+  for (auto &candidate : baseModifications) {
+    unsigned long id = baseId;
+    baseId++;
+    if (stage.atomicOnly && !generator::isAtomic(candidate))
+      continue;
+    BaseCandidate base;
+    base.id = id;
+    base.expression = candidate.first;
+    base.meta = candidate.second;
+    base.cost = syntacticDiff(Patch{PatchID{0}, sa, candidate.first, candidate.second});
+    base.hasBool2 = generator::hasNodeOfKind(candidate.first, NodeKind::BOOL2);
+    base.hasParameter = generator::hasNodeOfKind(candidate.first, NodeKind::PARAMETER);
+    base.parameterCompared = generator::parametersOnlyCompared(candidate.first);
+    base.inPrevious = previous && (!previous->atomicOnly || generator::isAtomic(candidate));
+    needBool2 = needBool2 || base.hasBool2;
+    bases.push_back(std::move(base));
+  }
+  endId = baseId;
+
+  // cost does not depend on BOOL2 and parameter values
+  std::stable_sort(bases.begin(), bases.end(),
+                   [](const BaseCandidate &a, const BaseCandidate &b) { return a.cost < b.cost; });
+
+  if (needBool2) {
+    bool2Expressions = synthesis::bool2Expressions(sa->components, removed);
+    for (auto &e : bool2Expressions) {
+      bool2HasParameter.push_back(generator::hasNodeOfKind(e, NodeKind::PARAMETER));
+      bool2ParameterCompared.push_back(generator::parametersOnlyCompared(e));
+    }
+  }
+
+  for (auto &base : bases) {
+    for (unsigned long bool2 = 0; bool2 < numBool2(base); bool2++) {
+      pair<unsigned long, unsigned long> range = parameterRange(base, bool2);
+      if (range.first < range.second)
+        count += range.second - range.first;
+    }
+  }
+
+  cursor = Cursor{0, 0, 0};
+  settle(cursor);
+}
+
+bool CandidateStream::empty() const {
+  return cursor.base >= bases.size();
+}
+
+double CandidateStream::cost() const {
+  return bases[cursor.base].cost;
+}
+
+Patch CandidateStream::next() {
+  const BaseCandidate &base = bases[cursor.base];
+  PatchID id{0};
+  id.base = base.id;
+  Expression instance = base.expression;
+  if (base.hasBool2) {
+    id.bool2 = cursor.bool2 + 1; // 0 means disabled
+    generator::substituteNodeOfKind(instance, NodeKind::BOOL2, bool2Expressions[cursor.bool2]);
+  }
+  if (generator::hasNodeOfKind(instance, NodeKind::PARAMETER)) {
+    id.param = parametersOf(base, cursor.bool2).values[cursor.param];
+    generator::substituteNodeOfKind(instance, NodeKind::PARAMETER, makeIntegerConst(id.param));
+  }
+  Patch result{id, sa, instance, base.meta};
+  cursor.param++;
+  settle(cursor);
+  return result;
+}
+
+unsigned long CandidateStream::size() const {
+  return count;
+}
+
+std::shared_ptr<SchemaApplication> CandidateStream::app() const {
+  return sa;
+}
+
+unsigned long CandidateStream::endBaseId() const {
+  return endId;
+}
+
+std::unordered_set<PatchID> CandidateStream::ids() const {
+  std::unordered_set<PatchID> result;
+  Cursor current{0, 0, 0};
+  for (settle(current); current.base < bases.size(); current.param++, settle(current)) {
+    PatchID id{0};
+    id.base = bases[current.base].id;
+    if (bases[current.base].hasBool2)
+      id.bool2 = current.bool2 + 1;
+    id.param = parametersOf(bases[current.base], current.bool2).values[current.param];
+    result.insert(id);
+  }
+  return result;
+}
+
+unsigned long CandidateStream::numBool2(const BaseCandidate &base) const {
+  return base.hasBool2 ? bool2Expressions.size() : 1;
+}
+
+const CandidateStream::ParameterValues &CandidateStream::parametersOf(const BaseCandidate &base,
+                                                                      unsigned long bool2) const {
+  // NOTE: profiled values are close to the values the parameter is compared with,
+  // but not to the values it is used as (e.g. "return p") or combined with (e.g. "x + p > y")
+  bool compared = base.parameterCompared && (! base.hasBool2 || bool2ParameterCompared[bool2]);
+  return compared ? comparedParameters : allParameters;
+}
+
+pair<unsigned long, unsigned long> CandidateStream::parameterRange(const BaseCandidate &base,
+                                                                   unsigned long bool2) const {
+  bool parametrized = base.hasParameter || (base.hasBool2 && bool2HasParameter[bool2]);
+  const ParameterValues &parameters = parametersOf(base, bool2);
+  // NOTE: the first parameter value is 0, which is used for candidates without parameters
+  unsigned long last = (parametrized ? parameters.values.size() : 1);
+  unsigned long first = 0;
+  if (base.inPrevious)
+    first = (parametrized ? parameters.previousCount : 1);
+  return make_pair(first, last);
+}
+
+void CandidateStream::settle(Cursor &current) const {
+  while (current.base < bases.size()) {
+    if (current.bool2 < numBool2(bases[current.base])) {
+      pair<unsigned long, unsigned long> range = parameterRange(bases[current.base], current.bool2);
+      if (current.param < range.first)
+        current.param = range.first;
+      if (current.param < range.second)
+        return;
+      current.bool2++;
     } else {
-      outputType = sa->original.rawType;
+      current.base++;
+      current.bool2 = 0;
     }
+    current.param = 0;
+  }
+}
+
+
+SearchSpace::SearchSpace(const vector<shared_ptr<SchemaApplication>> &schemaApplications,
+                         const ExpansionStage &stage,
+                         const ExpansionStage *previous,
+                         const std::unordered_set<AppID> &excluded):
+  total(0),
+  counter(0),
+  scheduled(cfg.locationScheduling),
+  partitionApp(0),
+  partitionValid(false) {
+  unsigned long baseId = 1; // because 0 is reserved:
+  for (auto sa : schemaApplications) {
+    CandidateStream stream(sa, stage, previous, baseId);
+    // NOTE: base ids of the remaining locations must not depend on the excluded ones
+    baseId = stream.endBaseId();
+    if (excluded.count(sa->id) || stream.empty())
+      continue;
+    total += stream.size();
+    streamByApp[sa->id] = streams.size();
+    streams.push_back(std::move(stream));
+    if (! scheduled)
+      queue.push(priority(streams.size() - 1));
+  }
+  spentTime.assign(streams.size(), 0.0);
+  takenCount.assign(streams.size(), 0);
+}
+
+std::tuple<double, double, unsigned long> SearchSpace::priority(unsigned long index) const {
+  double cost = streams[index].cost();
+  if (cfg.costBand > 0)
+    cost = std::floor(cost / cfg.costBand);
+  return std::make_tuple(cost, - streams[index].app()->suspiciousness, index);
+}
+
+bool SearchSpace::empty() const {
+  if (scheduled)
+    return counter >= total;
+  return queue.empty();
+}
+
+Patch SearchSpace::next() {
+  if (scheduled)
+    return nextScheduled();
+  unsigned long index = std::get<2>(queue.top());
+  queue.pop();
+  Patch result = streams[index].next();
+  if (! streams[index].empty())
+    queue.push(priority(index));
+  counter++;
+  return result;
+}
 
-    OH << outputType << " __f1x_" 
-       << generator::locationNameSuffix(sa->location)
-       << "(" << generator::parameterList(sa) << ")"
-       << ";" << "\n";
+// NOTE: streams are scanned for each candidate, which is negligible compared to test executions
+Patch SearchSpace::nextScheduled() {
+  bool found = false;
+  double tier = 0;
+  for (unsigned long index = 0; index < streams.size(); index++) {
+    if (streams[index].empty())
+      continue;
+    double cost = std::get<0>(priority(index));
+    if (! found || cost < tier)
+      tier = cost;
+    found = true;
   }
 
-  OH << "#ifdef __cplusplus" << "\n"
-     << "}" << "\n"
-     << "#endif" << "\n";
+  unsigned long best = 0;
+  double bestShare = 0;
+  found = false;
+  for (unsigned long index = 0; index < streams.size(); index++) {
+    if (streams[index].empty() || std::get<0>(priority(index)) != tier)
+      continue;
+    double remaining = streams[index].size() - takenCount[index];
+    double weight = (1.0 + streams[index].app()->suspiciousness) * std::log2(2.0 + remaining);
+    double share = spentTime[index] / weight;
+    if (! found || share < bestShare || (share == bestShare && priority(index) < priority(best))) {
+      best = index;
+      bestShare = share;
+      found = true;
+    }
+  }
+
+  Patch result = streams[best].next();
+  takenCount[best]++;
+  counter++;
+  return result;
+}
 
-  // source
+void SearchSpace::reportTime(AppID app, double seconds) {
+  auto stream = streamByApp.find(app);
+  if (stream != streamByApp.end())
+    spentTime[stream->second] += seconds;
+}
 
-  vector<Patch> searchSpace;
-  
-  generator::partitioningFunctions(schemaApplications, OS, searchSpace);  
+unsigned long SearchSpace::size() const {
+  return total;
+}
 
-  return searchSpace;
+unsigned long SearchSpace::explored() const {
+  return counter;
+}
+
+const std::unordered_set<PatchID> &SearchSpace::candidatesOf(AppID app) {
+  if (! partitionValid || partitionApp != app) {
+    auto stream = streamByApp.find(app);
+    if (stream != streamByApp.end())
+      partition = streams[stream->second].ids();
+    else
+      partition.clear();
+    partitionApp = app;
+    partitionValid = true;
+  }
+  return partition;
 }
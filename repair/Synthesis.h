@@ -16,7 +16,14 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#pragma once
+
+#include <functional>
 #include <memory>
+#include <queue>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 
 #include <boost/filesystem.hpp>
 
@@ -44,7 +51,177 @@
   append || A (&& A) = depth(A) 
  */
 
-std::vector<Patch>
-generateSearchSpace(const std::vector<std::shared_ptr<SchemaApplication>> &schemaApplications,
-                    std::ostream &OS,
-                    std::ostream &OH);
+/*
+  The runtime header declares the same interface for all search spaces, and the profiling runtime implements it too:
+  the project is built once, and only the runtime library (libf1xrt.so) linked to it is replaced
+ */
+void generateRuntimeHeader(std::ostream &OH);
+
+/*
+  Runtime definitions that never execute candidates (no application is selected),
+  used by the profiling runtime that does not record values
+ */
+void generateInactiveRuntime(std::ostream &OS);
+
+/*
+  Runtime definitions of the profiling runtime that records values (see Profiler): when __f1x_trace returns non-zero,
+  the call site passes its arguments to __f1x_observe, which passes the values of integer components and
+  of the original expression to __f1x_record(long long) defined by the profiling runtime.
+  Nothing is evaluated instead of the original code, since no application is selected
+ */
+void generateObservingRuntime(const std::vector<std::shared_ptr<SchemaApplication>> &schemaApplications,
+                              std::ostream &OS);
+
+/*
+  The runtime evaluates all candidates of the given schema applications, the search space is expanded separately.
+  Equivalent modifications (and BOOL2 expressions) of each location are removed before generation;
+  returns the number of removed ones
+ */
+unsigned long generateRuntime(const std::vector<std::shared_ptr<SchemaApplication>> &schemaApplications,
+                              std::ostream &OS);
+
+/*
+  Angelic probing: while F1X_PROBE_KIND is set, the search runtime does not evaluate candidates of the active condition,
+  and instead forces its value (relative to the original value for flips). A location is hopeless if a failing test
+  does not pass with any of the probes, since no candidate at the location can make it pass (up to the bounded set
+  of value sequences). This is only concluded if each execution of the condition in the test was flipped
+  (see probesComplete); the number of executions is counted by a COUNT probe in the shared memory PROBE_FILE_NAME.
+ */
+enum class ProbeKind {
+  NONE, ALWAYS_FALSE, ALWAYS_TRUE,
+  FLIP_AT,   // only the given execution is flipped (counting from 0)
+  FLIP_FROM, // all executions starting from the given one are flipped
+  COUNT      // the original value, the maximum number of executions in a process is recorded
+};
+
+struct Probe {
+  ProbeKind kind;
+  unsigned long execution;
+};
+
+// constant values, then flips from and at each of the given number of executions, or only at the first and last ones
+std::vector<Probe> probes(unsigned long executions);
+
+// whether probes(executions) flip each execution
+bool probesComplete(unsigned long executions);
+
+/*
+  Iterative deepening: the search space is explored in stages, each stage containing the previous one.
+  Early stages include only atomic modifications (without BOOL2, loosening and tightening) with small parameter bounds,
+  the last stage is the complete search space. Patch ids do not depend on the stage.
+ */
+struct ExpansionStage {
+  bool atomicOnly;
+  unsigned maxConditionParameter;
+  unsigned maxExpressionParameter;
+};
+
+// a single complete stage, unless iterative deepening is enabled
+std::vector<ExpansionStage> expansionStages();
+
+/*
+  Candidates of a schema application in the order of increasing cost (syntacticDiff) that are generated on demand.
+  Cost depends only on base modification, so base modifications are sorted, and BOOL2 and parameter values
+  are instantiated only when a candidate is requested. Candidates of the previous stage are skipped.
+ */
+class CandidateStream {
+ public:
+  CandidateStream(std::shared_ptr<SchemaApplication> sa,
+                  const ExpansionStage &stage,
+                  const ExpansionStage *previous,
+                  unsigned long firstBaseId);
+  bool empty() const;
+  double cost() const; // of the next candidate
+  Patch next();
+  unsigned long size() const;
+  unsigned long endBaseId() const;
+  std::shared_ptr<SchemaApplication> app() const;
+  std::unordered_set<PatchID> ids() const;
+
+ private:
+  struct BaseCandidate {
+    unsigned long id;
+    Expression expression;
+    PatchMetadata meta;
+    double cost;
+    bool hasBool2;
+    bool hasParameter;
+    bool parameterCompared; // see parametersOf
+    bool inPrevious;
+  };
+
+  struct ParameterValues {
+    std::vector<unsigned long> values; // of the stage in increasing order, starting from 0
+    unsigned long previousCount; // number of values of the previous stage
+  };
+
+  // position of the next candidate: base modification, BOOL2 expression, index of parameter value (see parametersOf)
+  struct Cursor {
+    unsigned long base;
+    unsigned long bool2;
+    unsigned long param;
+  };
+
+  unsigned long numBool2(const BaseCandidate &base) const;
+  // profiled values if each parameter of the candidate is an operand of a comparison, otherwise all values
+  const ParameterValues &parametersOf(const BaseCandidate &base, unsigned long bool2) const;
+  // indexes [first, second) of parameter values of the stage
+  std::pair<unsigned long, unsigned long> parameterRange(const BaseCandidate &base, unsigned long bool2) const;
+  // moves cursor to the next existing candidate
+  void settle(Cursor &current) const;
+
+  std::shared_ptr<SchemaApplication> sa;
+  std::vector<BaseCandidate> bases;
+  std::vector<Expression> bool2Expressions;
+  std::vector<bool> bool2HasParameter;
+  std::vector<bool> bool2ParameterCompared;
+  ParameterValues allParameters;
+  ParameterValues comparedParameters; // see SchemaApplication::parameterValues
+  unsigned long endId;
+  unsigned long count;
+  Cursor cursor;
+};
+
+/*
+  Search space of a stage as a k-way merge of candidate streams of all locations;
+  candidates of the same cost (or the same cost band, see cfg.costBand) are ordered by suspiciousness of location,
+  then by location, so without suspiciousness the order is the same as of a stable sort by cost.
+  With cfg.locationScheduling, locations of the cheapest cost tier are instead interleaved as arms of a bandit:
+  the next candidate is taken from the location with the least reported execution time relative to its weight,
+  which grows with suspiciousness and the number of remaining candidates. Thus, all locations of the tier are tried
+  before any of them gets a second costly candidate, and locations that refute candidates quickly get more of them.
+ */
+class SearchSpace {
+ public:
+  SearchSpace(const std::vector<std::shared_ptr<SchemaApplication>> &schemaApplications,
+              const ExpansionStage &stage,
+              const ExpansionStage *previous,
+              const std::unordered_set<AppID> &excluded);
+  bool empty() const;
+  Patch next();
+  unsigned long size() const;
+  unsigned long explored() const;
+  // all candidates of the application in this search space, used for partitioning
+  const std::unordered_set<PatchID> &candidatesOf(AppID app);
+  // time spent executing tests for a candidate of the application
+  void reportTime(AppID app, double seconds);
+
+ private:
+  Patch nextScheduled();
+  std::vector<CandidateStream> streams;
+  std::unordered_map<AppID, unsigned long> streamByApp;
+  // cost (or cost band), negated suspiciousness and index of the stream:
+  std::tuple<double, double, unsigned long> priority(unsigned long index) const;
+  std::priority_queue<std::tuple<double, double, unsigned long>,
+                      std::vector<std::tuple<double, double, unsigned long>>,
+                      std::greater<std::tuple<double, double, unsigned long>>> queue;
+  unsigned long total;
+  unsigned long counter;
+  bool scheduled;
+  std::vector<double> spentTime; // by stream
+  std::vector<unsigned long> takenCount; // by stream
+  // partition of the last requested application
+  AppID partitionApp;
+  bool partitionValid;
+  std::unordered_set<PatchID> partition;
+};
@@ -23,6 +23,10 @@
 #include <string>
 #include <sys/stat.h>
 #include <sstream>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <unordered_set>
 
 #include <boost/filesystem/fstream.hpp>
 
@@ -61,16 +65,42 @@ InEnvironment::InEnvironment(const std::map<std::string, std::string> &env) {
     string orig;
     if (getenv(entry.first.c_str())) {
       original[entry.first] = getenv(entry.first.c_str());
+    } else {
+      undefined.push_back(entry.first);
     }
     setenv(entry.first.c_str(), entry.second.c_str(), true);
   }
 }
 
 InEnvironment::~InEnvironment() {
-  // TODO: possibly can also erase previously undefined
   for (auto &entry : original) {
     setenv(entry.first.c_str(), entry.second.c_str(), true);
   }
+  for (auto &name : undefined) {
+    unsetenv(name.c_str());
+  }
+}
+
+void parallelFor(unsigned long size, unsigned jobs, const std::function<void(unsigned long, unsigned)> &body) {
+  if (jobs <= 1 || size <= 1) {
+    for (unsigned long index = 0; index < size; index++) {
+      body(index, 0);
+    }
+    return;
+  }
+  std::atomic<unsigned long> next(0);
+  vector<std::thread> workers;
+  for (unsigned worker = 0; worker < jobs && worker < size; worker++) {
+    workers.push_back(std::thread([&, worker]() {
+      unsigned long index;
+      while ((index = next++) < size) {
+        body(index, worker);
+      }
+    }));
+  }
+  for (auto &thread : workers) {
+    thread.join();
+  }
 }
 
 bool isAbstractNode(NodeKind kind) {
@@ -234,14 +264,41 @@ string operatorToString(const Operator &op) {
 }
 
 
+// NOTE: local statics, because symbols are created during static initialization
+
+const std::string *Symbol::empty() {
+  static const std::string emptyString;
+  return &emptyString;
+}
+
+const std::string *Symbol::intern(const std::string &s) {
+  if (s.empty())
+    return empty();
+  // symbols already seen by this thread are found without locking the shared table
+  thread_local std::unordered_map<std::string, const std::string *> cache;
+  auto cached = cache.find(s);
+  if (cached != cache.end())
+    return cached->second;
+  static std::mutex tableMutex;
+  static std::unordered_set<std::string> table;
+  const std::string *value;
+  {
+    std::lock_guard<std::mutex> lock(tableMutex);
+    value = &*table.insert(s).first;
+  }
+  cache.emplace(s, value);
+  return value;
+}
+
+
 std::string expressionToString(const Expression &expression) {
   if (expression.args.size() == 0) {
     return expression.repr;
   } else if (expression.args.size() == 1) {
-    return expression.repr + " " + expressionToString(expression.args[0]);
+    return expression.repr.str() + " " + expressionToString(expression.args[0]);
   } if (expression.args.size() == 2) {
     return "(" + expressionToString(expression.args[0]) + " " +
-           expression.repr + " " +
+           expression.repr.str() + " " +
            expressionToString(expression.args[1]) + ")";
   }
   throw std::invalid_argument("unsupported expression");
@@ -499,7 +556,9 @@ vector<shared_ptr<SchemaApplication>> loadSAFile(const fs::path &path) {
                                                             context,
                                                             expression,
                                                             components,
-                                                            completePointeeTypes });
+                                                            completePointeeTypes,
+                                                            {},
+                                                            0.0 });
     result.push_back(sa);
   }
 
@@ -571,15 +630,3 @@ std::string prettyPrintTests(const std::vector<std::string> &tests) {
   printTests << "]";
   return printTests.str();
 }
-
-
-void dumpSearchSpace(vector<Patch> &searchSpace,
-                     const fs::path &file,
-                     const vector<fs::path> &files,
-                     std::unordered_map<PatchID, double> &cost) {
-    fs::ofstream os(file);
-    for (auto &el : searchSpace) {
-        os << std::setprecision(3) << cost[el.id] << " "
-           << visualizeElement(el, files[el.app->location.fileId]) << "\n";
-    }
-}
\ No newline at end of file
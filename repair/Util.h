@@ -19,6 +19,7 @@
 #pragma once
 
 #include <unordered_map>
+#include <functional>
 #include "Config.h"
 #include "Core.h"
 #include "Project.h"
@@ -124,9 +125,17 @@ class InEnvironment {
 
  private:
   std::map<std::string, std::string> original;
+  std::vector<std::string> undefined;
 };
 
 
+/*
+  Calls body(index, worker) for each index in [0, size) using the given number of worker threads;
+  indexes are processed in increasing order of start.
+ */
+void parallelFor(unsigned long size, unsigned jobs, const std::function<void(unsigned long, unsigned)> &body);
+
+
 class parse_error : public std::logic_error {
  public:
   using std::logic_error::logic_error;
@@ -145,9 +154,3 @@ boost::filesystem::path relativeTo(boost::filesystem::path from, boost::filesyst
 const unsigned long MAX_PRINT_TESTS = 5;
 
 std::string prettyPrintTests(const std::vector<std::string> &tests);
-
-
-void dumpSearchSpace(std::vector<Patch> &searchSpace,
-                     const boost::filesystem::path &file,
-                     const std::vector<boost::filesystem::path> &files,
-                     std::unordered_map<PatchID, double> &cost);
\ No newline at end of file
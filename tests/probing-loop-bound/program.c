@@ -0,0 +1,13 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char *argv[]) {
+  int n, i, sum;
+  n = atoi(argv[1]);
+  sum = 0;
+  for (i = 0; i < n; i++) { // <=
+    sum += i;
+  }
+  printf("%d\n", sum);
+  return 0;
+}
@@ -0,0 +1,20 @@
+#!/bin/bash
+
+assert-equal () {
+    diff -q <($1) <(echo -ne "$2") > /dev/null
+}
+
+case "$1" in
+    n1)
+        assert-equal "./program 20" '210\n'
+        ;;
+    n2)
+        assert-equal "./program 30" '465\n'
+        ;;
+    p1)
+        assert-equal "./program 0" '0\n'
+        ;;
+    *)
+        exit 1
+        ;;
+esac
@@ -0,0 +1,11 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+int get_value(int x) {
+  return x; // 1
+}
+
+int main(int argc, char *argv[]) {
+  printf("%d\n", get_value(atoi(argv[1])));
+  return 0;
+}
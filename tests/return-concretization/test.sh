@@ -0,0 +1,17 @@
+#!/bin/bash
+
+assert-equal () {
+    diff -q <($1) <(echo -ne "$2") > /dev/null
+}
+
+case "$1" in
+    n1)
+        assert-equal "./program 5" '1\n'
+        ;;
+    n2)
+        assert-equal "./program 7" '1\n'
+        ;;
+    *)
+        exit 1
+        ;;
+esac
@@ -107,12 +107,52 @@ get-cmd () {
         signed-int-overflow)
             echo "f1x --files program.c:9 --driver test.sh --tests n1 --test-timeout 1000 --disable-vteq"
             ;;
+        probing-loop-bound)
+            echo "f1x --files program.c:8 --driver test.sh --tests n1 n2 p1 --test-timeout 1000 --enable-probing"
+            ;;
+        return-concretization)
+            echo "f1x --files program.c:5 --driver test.sh --tests n1 n2 --test-timeout 1000"
+            ;;
+        dump-patches)
+            echo "f1x --files program.c:7 --driver test.sh --tests n1 n2 n3 --test-timeout 1000 --dump-patches"
+            ;;
+        time-budget)
+            echo "f1x --files program.c --driver test.sh --tests n1 n2 p1 p2 p3 --test-timeout 1000 --time-budget 300"
+            ;;
         *)
             exit 1
             ;;
     esac
 }
 
+# each line of index.txt is "<position> <offset> <length> <app id> <patch id>" of a diff in patches.diff
+check-dump () {
+    local archive="$1/patches.diff"
+    local index="$1/index.txt"
+    [[ -s "$archive" && -s "$index" ]] || return 1
+    local total=0
+    while read position offset length app id; do
+        head -c $((offset + length)) "$archive" | tail -c "$length" | head -n 1 | grep -q '^--- a/program.c$' || return 1
+        total=$((total + length))
+    done < "$index"
+    [[ $total == $(stat -c %s "$archive") ]] || return 1
+    local count=$(wc -l < "$index")
+    [[ $(cut -d ' ' -f 1 "$index" | sort -n | uniq | wc -l) == $count ]] || return 1
+    [[ $(cut -d ' ' -f 1 "$index" | sort -n | tail -n 1) == $((count - 1)) ]] || return 1
+    grep -q '^+.*n >= 1' "$archive"
+}
+
+check-output () {
+    case "$1" in
+        dump-patches)
+            check-dump "$2"
+            ;;
+        *)
+            [[ -f "$2" && -s "$2" ]]
+            ;;
+    esac
+}
+
 cd "$( dirname "${BASH_SOURCE[0]}" )"
 
 if [[ -z "$TESTS" ]]; then
@@ -134,20 +174,13 @@ for test in $TESTS; do
 
     case "$test" in
         signed-int-overflow)
-            # The following is safer since we are using clang for F1X_PROJECT_CC
-            repair_cmd="$repair_cmd --enable-llvm-cov"
             (cd $work_dir; F1X_CC_LIBS='-lstdc++' F1X_RUNTIME_CXX='clang -fsanitize=undefined' F1X_PROJECT_CC='clang' $repair_cmd  --output "$work_dir/output.patch" --enable-cleanup &> "$work_dir/log.txt")
             ;;
         *)
-            # When F1X_PROJECT_CC is clang, we need to use --enable-llvm-cov
-            project_compiler=$(basename $F1X_PROJECT_CC 2> /dev/null)
-            if [[ $project_compiler = *"clang"* ]] ; then
-                repair_cmd="$repair_cmd --enable-llvm-cov"
-            fi
             (cd $work_dir; $repair_cmd  --output "$work_dir/output.patch" --enable-cleanup &> "$work_dir/log.txt")
             ;;
     esac
-    if [[ ($? != 0) || (! -f "$work_dir/output.patch") || (! -s "$work_dir/output.patch") ]]; then
+    if [[ ($? != 0) ]] || ! check-output "$test" "$work_dir/output.patch"; then
         echo 'FAIL'
         echo "----------------------------------------"
         case "$test" in
@@ -0,0 +1,17 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+int main(int argc, char *argv[]) {
+  int a, b;
+  a = atoi(argv[1]);
+  b = a * 2;
+  if (b > 100) {
+    b = 100;
+  }
+  if (a > 1) { // a > 5
+    printf("%d\n", b);
+  } else {
+    printf("%d\n", 0);
+  }
+  return 0;
+}
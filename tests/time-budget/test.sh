@@ -0,0 +1,26 @@
+#!/bin/bash
+
+assert-equal () {
+    diff -q <($1) <(echo -ne "$2") > /dev/null
+}
+
+case "$1" in
+    n1)
+        assert-equal "./program 3" '0\n'
+        ;;
+    n2)
+        assert-equal "./program 5" '0\n'
+        ;;
+    p1)
+        assert-equal "./program 6" '12\n'
+        ;;
+    p2)
+        assert-equal "./program 80" '100\n'
+        ;;
+    p3)
+        assert-equal "./program 0" '0\n'
+        ;;
+    *)
+        exit 1
+        ;;
+esac
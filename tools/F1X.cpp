@@ -114,10 +114,15 @@ int main (int argc, char *argv[]) {
     ("test-timeout,T", po::value<unsigned>()->value_name("MS"), "test execution timeout")
     ("files,f", po::value<vector<string>>()->multitoken()->value_name("PATH..."), "list of source files to repair")
     ("localize,l", po::value<unsigned>()->value_name("NUM"), ("number of files to localize (default: " + std::to_string(cfg.filesToLocalize) + ")").c_str())
+    ("components", po::value<unsigned>()->value_name("NUM"), ("number of most relevant components per location, 0 for unlimited (default: " + std::to_string(cfg.maxComponents) + ")").c_str())
+    ("jobs,j", po::value<unsigned>()->value_name("NUM"), ("number of tests executed in parallel during profiling (default: " + std::to_string(cfg.testJobs) + ")").c_str())
     ("build,b", po::value<string>()->value_name("CMD"), ("build command (default: " + buildCmd + ")").c_str())
     ("output,o", po::value<string>()->value_name("PATH"), "output patch file or directory (default: f1x-TIME)")
     ("all,a", "generate all patches")
     ("cost,c", po::value<string>()->value_name("FUNCTION"), "patch prioritization (default: syntactic-diff)")
+    ("suspiciousness", po::value<string>()->value_name("FORMULA"), "location prioritization among patches of the same cost (default: ochiai)")
+    ("cost-band", po::value<double>()->value_name("WIDTH"), "prioritize locations among patches with cost within the same band")
+    ("time-budget", po::value<unsigned>()->value_name("SEC"), "search time limit, locations are interleaved to explore more of them")
     ("verbose,v", "produce extended output")
     ("help,h", "produce help message and exit")
     ("version", "print version and exit")
@@ -129,12 +134,16 @@ int main (int argc, char *argv[]) {
     ("enable-metadata", "output patch metadata")
     ("enable-validation", "validate found patches")
     ("enable-assignment", "synthesize assignments")
-    ("enable-llvm-cov", "use llvm-cov instead of gcov")
+    ("enable-llvm-cov", "[DEPRECATED] has no effect")
     ("disable-guard", "don't synthesize guards")
+    ("enable-deepening", "expand search space in stages for unresolved locations")
+    ("enable-probing", "discard conditions that cannot make failing tests pass with forced values")
+    ("enable-interleaving", "interleave locations of the same cost based on test execution time")
     ("disable-vteq", "[DEBUG] don't apply value-based analysis")
     ("disable-dteq", "[DEBUG] don't apply dependency-based analysis")
     ("disable-testprior", "[DEBUG] don't prioritize tests")
-    ("dump-patches", "dump patches")
+    ("disable-vprofile", "[DEBUG] don't restrict compared parameters to profiled values")
+    ("dump-patches", "dump all candidate patches into a single indexed archive")
     ;
 
   po::variables_map vm;
@@ -169,6 +178,37 @@ int main (int argc, char *argv[]) {
     }
   }
 
+  if (vm.count("suspiciousness")) {
+    std::string formula = vm["suspiciousness"].as<string>();
+
+    if (formula == "ochiai") {
+      cfg.locationPrioritization = LocationPrioritization::OCHIAI;
+    } else if (formula == "tarantula") {
+      cfg.locationPrioritization = LocationPrioritization::TARANTULA;
+    } else if (formula == "none") {
+      cfg.locationPrioritization = LocationPrioritization::NONE;
+    } else {
+      BOOST_LOG_TRIVIAL(error) << "supported suspiciousness formulas: ochiai, tarantula, none";
+      return ERROR_EXIT_CODE;
+    }
+  }
+
+  if (vm.count("cost-band")) {
+    cfg.costBand = vm["cost-band"].as<double>();
+  }
+
+  if (vm.count("enable-interleaving")) {
+    cfg.locationScheduling = true;
+  }
+
+  if (vm.count("time-budget")) {
+    cfg.timeBudget = vm["time-budget"].as<unsigned>();
+    if (!cfg.locationScheduling) {
+      cfg.locationScheduling = true;
+      BOOST_LOG_TRIVIAL(info) << "interleaving locations to explore more of them within the time budget";
+    }
+  }
+
   if (vm.count("version")) {
     std::cout << "f1x " << F1X_VERSION_MAJOR <<
                     "." << F1X_VERSION_MINOR <<
@@ -209,7 +249,7 @@ int main (int argc, char *argv[]) {
   }
 
   if (vm.count("enable-llvm-cov")) {
-    cfg.useLLVMCov = true;
+    BOOST_LOG_TRIVIAL(warning) << "--enable-llvm-cov is deprecated and has no effect: coverage is collected by the profiling runtime";
   }
 
   if (vm.count("disable-vteq")) {
@@ -220,10 +260,22 @@ int main (int argc, char *argv[]) {
     cfg.testPrioritization = TestPrioritization::FIXED_ORDER;
   }
 
+  if (vm.count("disable-vprofile")) {
+    cfg.valueProfiling = false;
+  }
+
   if (vm.count("disable-guard")) {
     cfg.addGuards = false;
   }
 
+  if (vm.count("enable-deepening")) {
+    cfg.iterativeDeepening = true;
+  }
+
+  if (vm.count("enable-probing")) {
+    cfg.angelicProbing = true;
+  }
+
   if (vm.count("output-space")) {
     cfg.searchSpaceFile = fs::absolute(vm["output-space"].as<string>()).string();
   }
@@ -250,6 +302,14 @@ int main (int argc, char *argv[]) {
     cfg.filesToLocalize = vm["localize"].as<unsigned>();
   }
 
+  if (vm.count("components")) {
+    cfg.maxComponents = vm["components"].as<unsigned>();
+  }
+
+  if (vm.count("jobs")) {
+    cfg.testJobs = std::max(1u, vm["jobs"].as<unsigned>());
+  }
+
   if (vm.count("files")) {
     vector<string> fileArgs = vm["files"].as<vector<string>>();
     try {
@@ -16,6 +16,12 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <vector>
+
 #include "clang/Tooling/CommonOptionsParser.h"
 #include "clang/Tooling/Tooling.h"
 // Declares llvm::cl::extrahelp.
@@ -23,9 +29,9 @@
 
 #include "TransformGlobal.h"
 #include "TransformUtil.h"
-#include "ProfileInstrumentation.h"
 #include "SchemaApplication.h"
 #include "PatchApplication.h"
+#include "TransformRunner.h"
 #include "Config.h"
 
 using namespace clang::tooling;
@@ -43,32 +49,49 @@ static cl::extrahelp MoreHelp("\nf1x-transform is a tool used internally by f1x\
 // only ones displayed.
 static llvm::cl::OptionCategory F1XCategory("f1x-transform options");
 
+static cl::opt<bool>
+Server("server", cl::desc("serve transformation requests from stdin"), cl::cat(F1XCategory));
+
 static cl::opt<bool>
 Global("global", cl::desc("use global variables"), cl::cat(F1XCategory));
 
 // Search space instrumentation options:
 
+static cl::opt<bool>
+Instrument("instrument", cl::desc("instrument search space"), cl::cat(F1XCategory));
+
 static cl::opt<std::string>
-Instrument("instrument", cl::desc("instrument search space with profile"), cl::cat(F1XCategory));
+Profile("profile", cl::desc("instrument only locations from profile (not used in the server mode)"), cl::cat(F1XCategory));
 
-static cl::opt<bool>
-Profile("profile", cl::desc("instrument search space for profile"), cl::cat(F1XCategory));
+static cl::opt<std::string>
+Locations("locations", cl::desc("output file for instrumented locations"), cl::cat(F1XCategory));
 
 static cl::opt<bool>
 DisableGuard("disable-guard", cl::desc("don't instrument guards"), cl::cat(F1XCategory));
 
-static cl::opt<unsigned>
-FileId("file-id", cl::desc("file id"), cl::cat(F1XCategory));
+// NOTE: the following are given once per source file, in the order of source files
 
-static cl::opt<unsigned>
-FromLine("from-line", cl::desc("from line"), cl::cat(F1XCategory));
+static cl::list<unsigned>
+FileId("file-id", cl::desc("file id"), cl::ZeroOrMore, cl::cat(F1XCategory));
+
+static cl::list<unsigned>
+FromLine("from-line", cl::desc("from line"), cl::ZeroOrMore, cl::cat(F1XCategory));
+
+static cl::list<unsigned>
+ToLine("to-line", cl::desc("to line"), cl::ZeroOrMore, cl::cat(F1XCategory));
 
 static cl::opt<unsigned>
-ToLine("to-line", cl::desc("to line"), cl::cat(F1XCategory));
+Jobs("jobs", cl::desc("number of parallel transformations"), cl::init(std::thread::hardware_concurrency()), cl::cat(F1XCategory));
+
+static cl::opt<std::string>
+PCHDir("pch-dir", cl::desc("directory for precompiled preambles (disabled if not given)"), cl::cat(F1XCategory));
 
 static cl::opt<std::string>
 Output("output", cl::desc("output file"), cl::cat(F1XCategory));
 
+static cl::opt<unsigned>
+MaxComponents("max-components", cl::desc("number of most relevant components per location (0 for unlimited)"), cl::cat(F1XCategory));
+
 
 // Patch application options:
 
@@ -91,38 +114,134 @@ static cl::opt<std::string>
 Patch("patch", cl::desc("replacement"), cl::cat(F1XCategory));
 
 
+enum class TransformMode { INSTRUMENT, APPLY };
+
+static bool transform(TransformRunner &runner, TransformMode mode, const std::vector<TransformedFile> &files) {
+  std::vector<std::unique_ptr<TransformState>> states;
+  for (auto &file : files) {
+    states.push_back(std::unique_ptr<TransformState>(new TransformState(file)));
+  }
+
+  TransformActionFactory makeAction;
+  switch (mode) {
+  case TransformMode::APPLY:
+    makeAction = [](TransformState &state) -> FrontendAction* { return new PatchApplicationAction(state); };
+    break;
+  case TransformMode::INSTRUMENT:
+    initInterestingLocations(cfg.profileFile);
+    makeAction = [](TransformState &state) -> FrontendAction* { return new SchemaApplicationAction(state); };
+    break;
+  }
+
+  bool success = runner.run(states, makeAction);
+
+  if (mode == TransformMode::INSTRUMENT) {
+    if (!saveSchemaApplications(states, cfg.outputFile)) {
+      errs() << "error: failed to write " << cfg.outputFile << "\n";
+      return false;
+    }
+    if (!cfg.locationsFile.empty() && !saveProfiledLocations(states, cfg.locationsFile)) {
+      errs() << "error: failed to write " << cfg.locationsFile << "\n";
+      return false;
+    }
+  }
+
+  return success;
+}
+
+/*
+  In the server mode, the same runner (with its compile commands and file managers) is used for all requests.
+  Requests are read from stdin one per line, "ok" or "error" is written to stdout after each of them:
+    instrument OUTPUT LOCATIONS
+    apply FILE_ID BL BC EL EC PATCH
+  The server terminates when stdin is closed.
+  There is no profiling request: the repair module instruments all locations once, before profiling,
+  and the same build is used for profiling and search, so -profile (and the line filtering of
+  SchemaApplicationASTConsumer) applies only to the command-line mode.
+ */
+static int serve(TransformRunner &runner) {
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    std::istringstream request(line);
+    std::string kind;
+    request >> kind;
+    bool success = false;
+    if (kind == "instrument") {
+      // NOTE: in the server mode, all locations are instrumented, since there is no profile yet
+      cfg.profileFile = "";
+      request >> cfg.outputFile >> cfg.locationsFile;
+      success = transform(runner, TransformMode::INSTRUMENT, cfg.files);
+    } else if (kind == "apply") {
+      unsigned fileId;
+      request >> fileId >> cfg.beginLine >> cfg.beginColumn >> cfg.endLine >> cfg.endColumn >> std::ws;
+      std::getline(request, cfg.patch);
+      std::vector<TransformedFile> selected;
+      for (auto &file : cfg.files) {
+        if (file.fileId == fileId)
+          selected.push_back(file);
+      }
+      success = !selected.empty() && transform(runner, TransformMode::APPLY, selected);
+    } else {
+      errs() << "error: unsupported request " << line << "\n";
+    }
+    outs() << (success ? "ok" : "error") << "\n";
+    outs().flush();
+  }
+  return 0;
+}
+
 int main(int argc, const char **argv) {
   CommonOptionsParser OptionsParser(argc, argv, F1XCategory);
-  ClangTool Tool(OptionsParser.getCompilations(),
-                 OptionsParser.getSourcePathList());
+  const std::vector<std::string> &sources = OptionsParser.getSourcePathList();
 
-  std::unique_ptr<FrontendActionFactory> FrontendFactory;
+  if ((!FileId.empty() && FileId.size() != sources.size()) ||
+      (!FromLine.empty() && FromLine.size() != sources.size()) ||
+      (!ToLine.empty() && ToLine.size() != sources.size())) {
+    errs() << "error: -file-id, -from-line and -to-line must be given for each source file\n";
+    return 1;
+  }
 
-  cfg.fileId = FileId;
-  cfg.fromLine = FromLine;
-  cfg.toLine = ToLine;
-  cfg.profileFile = Instrument;
+  for (unsigned i = 0; i < sources.size(); i++) {
+    TransformedFile file;
+    file.path = sources[i];
+    file.fileId = FileId.empty() ? i : FileId[i];
+    file.fromLine = FromLine.empty() ? 0 : FromLine[i];
+    file.toLine = ToLine.empty() ? 0 : ToLine[i];
+    cfg.files.push_back(file);
+  }
+  cfg.jobs = Jobs ? Jobs : 1;
+  cfg.pchDir = PCHDir;
+  cfg.profileFile = Profile;
   cfg.outputFile = Output;
+  cfg.locationsFile = Locations;
   cfg.beginLine = BeginLine;
   cfg.beginColumn = BeginColumn;
   cfg.endLine = EndLine;
   cfg.endColumn = EndColumn;
   cfg.patch = Patch;
   cfg.useGlobalVariables = Global;
+  cfg.maxComponents = MaxComponents;
   if (DisableGuard) {
     cfg.addGuards = false;
   }
+  if (!cfg.inplaceModification) {
+    cfg.jobs = 1; // transformed files are printed to stdout
+  }
+
+  TransformRunner runner(OptionsParser.getCompilations(), cfg.jobs, cfg.pchDir);
 
-  if (Apply)
-    FrontendFactory = newFrontendActionFactory<PatchApplicationAction>();
-  else if(Profile)
-    FrontendFactory = newFrontendActionFactory<ProfileInstrumentationAction>();
-  else if (Instrument != "")
-    FrontendFactory = newFrontendActionFactory<SchemaApplicationAction>();
-  else {
-    errs() << "error: specify -profile -instrument FILE or -apply options\n";
+  if (Server)
+    return serve(runner);
+
+  TransformMode mode;
+  if (Apply) {
+    mode = TransformMode::APPLY;
+  } else if (Instrument) {
+    mode = TransformMode::INSTRUMENT;
+  } else {
+    errs() << "error: specify -instrument, -apply or -server options\n";
     return 1;
   }
-  
-  return Tool.run(FrontendFactory.get());
+
+  return transform(runner, mode, cfg.files) ? 0 : 1;
 }
@@ -29,18 +29,11 @@
 using namespace clang;
 using namespace ast_matchers;
 
-/*
-  Clang sometimes (for unknown reasons) starts the same file action or matches the same location twice, which causes crashes or invalid results.
-  This is to avoid doing the same twice.
-*/
-static bool alreadyTransformed = false;
-static std::unordered_set<Location> alreadyMatched;
-
 void PatchApplicationAction::EndSourceFileAction() {
-  if (alreadyTransformed) {
+  if (State.alreadyTransformed) {
     return;
   }
-  alreadyTransformed = true;
+  State.alreadyTransformed = true;
 
   FileID ID = TheRewriter.getSourceMgr().getMainFileID();
   if (cfg.inplaceModification) {
@@ -54,23 +47,28 @@ void PatchApplicationAction::EndSourceFileAction() {
 
 std::unique_ptr<ASTConsumer> PatchApplicationAction::CreateASTConsumer(CompilerInstance &CI, StringRef file) {
     TheRewriter.setSourceMgr(CI.getSourceManager(), CI.getLangOpts());
-    return llvm::make_unique<PatchApplicationASTConsumer>(TheRewriter);
+    return llvm::make_unique<PatchApplicationASTConsumer>(TheRewriter, State);
 }
 
 
-PatchApplicationASTConsumer::PatchApplicationASTConsumer(Rewriter &R) : 
-  ExpressionSchemaHandler(R),
-  IfGuardSchemaHandler(R) {
+PatchApplicationASTConsumer::PatchApplicationASTConsumer(Rewriter &R, TransformState &State) :
+  ExpressionSchemaHandler(R, State),
+  IfGuardSchemaHandler(R, State) {
   Matcher.addMatcher(ExpressionSchemaMatcher, &ExpressionSchemaHandler);    
   Matcher.addMatcher(IfGuardSchemaMatcher, &IfGuardSchemaHandler);
 }
 
 void PatchApplicationASTConsumer::HandleTranslationUnit(ASTContext &Context) {
-  Matcher.matchAST(Context);
+  // NOTE: only statements spanning the patched location can match
+  std::vector<unsigned> lines{ cfg.beginLine };
+  LineFilteredMatcher Visitor(Matcher, Context, lines);
+  Visitor.TraverseDecl(Context.getTranslationUnitDecl());
 }
 
 
-IfGuardPatchApplicationHandler::IfGuardPatchApplicationHandler(Rewriter &Rewrite) : Rewrite(Rewrite) {}
+IfGuardPatchApplicationHandler::IfGuardPatchApplicationHandler(Rewriter &Rewrite, TransformState &State) :
+  Rewrite(Rewrite),
+  State(State) {}
 
 void IfGuardPatchApplicationHandler::run(const MatchFinder::MatchResult &Result) {
   if (const Stmt *stmt = Result.Nodes.getNodeAs<clang::Stmt>(BOUND)) {
@@ -83,10 +81,10 @@ void IfGuardPatchApplicationHandler::run(const MatchFinder::MatchResult &Result)
       unsigned endLine = srcMgr.getExpansionLineNumber(expandedLoc.getEnd());
       unsigned endColumn = srcMgr.getExpansionColumnNumber(expandedLoc.getEnd());
 
-      Location current{cfg.fileId, beginLine, beginColumn, endLine, endColumn};
-      if (alreadyMatched.count(current))
+      Location current{State.file.fileId, beginLine, beginColumn, endLine, endColumn};
+      if (State.alreadyMatched.count(current))
         return;
-      alreadyMatched.insert(current);
+      State.alreadyMatched.insert(current);
 
       // NOTE: to avoid extracting locations from headers:
       std::pair<FileID, unsigned> decLoc = srcMgr.getDecomposedExpansionLoc(expandedLoc.getBegin());
@@ -133,7 +131,9 @@ void IfGuardPatchApplicationHandler::run(const MatchFinder::MatchResult &Result)
 }
 
 
-ExpressionPatchApplicationHandler::ExpressionPatchApplicationHandler(Rewriter &Rewrite) : Rewrite(Rewrite) {}
+ExpressionPatchApplicationHandler::ExpressionPatchApplicationHandler(Rewriter &Rewrite, TransformState &State) :
+  Rewrite(Rewrite),
+  State(State) {}
 
 void ExpressionPatchApplicationHandler::run(const MatchFinder::MatchResult &Result) {
   if (const Expr *expr = Result.Nodes.getNodeAs<clang::Expr>(BOUND)) {
@@ -146,10 +146,10 @@ void ExpressionPatchApplicationHandler::run(const MatchFinder::MatchResult &Resu
       unsigned endLine = srcMgr.getExpansionLineNumber(expandedLoc.getEnd());
       unsigned endColumn = srcMgr.getExpansionColumnNumber(expandedLoc.getEnd());
 
-      Location current{cfg.fileId, beginLine, beginColumn, endLine, endColumn};
-      if (alreadyMatched.count(current))
+      Location current{State.file.fileId, beginLine, beginColumn, endLine, endColumn};
+      if (State.alreadyMatched.count(current))
         return;
-      alreadyMatched.insert(current);
+      State.alreadyMatched.insert(current);
 
       // NOTE: to avoid extracting locations from headers:
       std::pair<FileID, unsigned long> decLoc = srcMgr.getDecomposedExpansionLoc(expandedLoc.getBegin());
@@ -26,35 +26,39 @@
 #include "clang/Rewrite/Core/Rewriter.h"
 #include "clang/ASTMatchers/ASTMatchFinder.h"
 
+#include "TransformUtil.h"
+
 using namespace clang;
 using namespace ast_matchers;
 
 
 class IfGuardPatchApplicationHandler : public MatchFinder::MatchCallback {
 public:
-  IfGuardPatchApplicationHandler(Rewriter &Rewrite);
+  IfGuardPatchApplicationHandler(Rewriter &Rewrite, TransformState &State);
 
   virtual void run(const MatchFinder::MatchResult &Result);
 
 private:
   Rewriter &Rewrite;
+  TransformState &State;
 };
 
 
 class ExpressionPatchApplicationHandler : public MatchFinder::MatchCallback {
 public:
-  ExpressionPatchApplicationHandler(Rewriter &Rewrite);
+  ExpressionPatchApplicationHandler(Rewriter &Rewrite, TransformState &State);
 
   virtual void run(const MatchFinder::MatchResult &Result);
 
 private:
   Rewriter &Rewrite;
+  TransformState &State;
 };
 
 
 class PatchApplicationASTConsumer : public ASTConsumer {
 public:
-  PatchApplicationASTConsumer(Rewriter &R);
+  PatchApplicationASTConsumer(Rewriter &R, TransformState &State);
 
   void HandleTranslationUnit(ASTContext &Context) override;
 
@@ -67,7 +71,7 @@ private:
 
 class PatchApplicationAction : public ASTFrontendAction {
 public:
-  PatchApplicationAction() {}
+  PatchApplicationAction(TransformState &State) : State(State) {}
 
   void EndSourceFileAction() override;
 
@@ -75,4 +79,5 @@ public:
 
 private:
   Rewriter TheRewriter;
+  TransformState &State;
 };
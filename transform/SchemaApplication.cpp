@@ -25,6 +25,7 @@
 #include <rapidjson/ostreamwrapper.h>
 #include <rapidjson/writer.h>
 #include <map>
+#include <algorithm>
 
 #include "Config.h"
 #include "TransformGlobal.h"
@@ -40,47 +41,86 @@ namespace json = rapidjson;
 using std::vector;
 using std::string;
 
-json::Document schemaApplications;
-
-std::unordered_set<std::string> interestingLocations;
-
-void initInterestingLocations() {
-  std::ifstream infile(cfg.profileFile);
-  std::string line;
-  while(std::getline(infile, line)) {
-    interestingLocations.insert(line);
+// NOTE: read-only after initialization, so they are shared between translation units
+bool useProfile = false;
+std::unordered_set<Location> interestingLocations;
+std::map<unsigned, vector<unsigned>> interestingLines; // sorted begin lines of locations for each file
+
+void initInterestingLocations(const std::string &profileFile) {
+  interestingLocations.clear();
+  interestingLines.clear();
+  useProfile = !profileFile.empty();
+  if (!useProfile)
+    return;
+  std::ifstream infile(profileFile);
+  Location location;
+  while(infile >> location.fileId
+               >> location.beginLine
+               >> location.beginColumn
+               >> location.endLine
+               >> location.endColumn) {
+    interestingLocations.insert(location);
+    interestingLines[location.fileId].push_back(location.beginLine);
+  }
+  for (auto &entry : interestingLines) {
+    std::sort(entry.second.begin(), entry.second.end());
   }
 }
 
 bool isInterestingLocation(unsigned fileId, unsigned beginLine, unsigned beginColumn, unsigned endLine, unsigned endColumn) {
-  std::ostringstream location;
-  location << fileId << " "
-           << beginLine << " "
-           << beginColumn << " "
-           << endLine << " "
-           << endColumn;
-
-  if(interestingLocations.find(location.str()) == interestingLocations.end())
-    return false;
+  if (!useProfile)
+    return true;
+  Location location{fileId, beginLine, beginColumn, endLine, endColumn};
+  return interestingLocations.count(location) > 0;
+}
 
+bool saveProfiledLocations(const std::vector<std::unique_ptr<TransformState>> &states, const std::string &outputFile) {
+  std::ofstream ofs(outputFile);
+  if (!ofs)
+    return false;
+  for (auto &state : states) {
+    for (unsigned long index = 0; index < state->profiledLocations.size(); index++) {
+      const Location &loc = state->profiledLocations[index];
+      ofs << loc.fileId << " "
+          << index << " "
+          << loc.beginLine << " "
+          << loc.beginColumn << " "
+          << loc.endLine << " "
+          << loc.endColumn << "\n";
+    }
+  }
   return true;
 }
 
-/*
-  Clang sometimes (for unknown reasons) starts the same file action or matches the same location twice, which causes crashes or invalid results.
-  This is to avoid doing the same twice.
-*/
-static bool alreadyTransformed = false;
-static std::unordered_set<Location> alreadyMatched;
+bool saveSchemaApplications(const std::vector<std::unique_ptr<TransformState>> &states, const std::string &outputFile) {
+  json::Document result;
+  result.SetArray();
+  for (auto &state : states) {
+    for (auto &app : state->schemaApplications.GetArray()) {
+      result.PushBack(json::Value(app, result.GetAllocator()), result.GetAllocator());
+    }
+  }
+
+  std::ofstream ofs(outputFile);
+  if (!ofs)
+    return false;
+  json::OStreamWrapper osw(ofs);
+  json::Writer<json::OStreamWrapper> writer(osw);
+  result.Accept(writer);
+  return true;
+}
 
 bool SchemaApplicationAction::BeginSourceFileAction(CompilerInstance &CI, StringRef Filename) {
-  if (alreadyTransformed) {
+  if (State.alreadyTransformed) {
     return false;
   }
-  alreadyTransformed = true;
+  State.alreadyTransformed = true;
+
+  std::unique_ptr<PPConditionalRecoder> recorder(new PPConditionalRecoder(State.conditionalsPP));
+
+  Preprocessor &pp = CI.getPreprocessor();
+  pp.addPPCallbacks(std::move(recorder));
 
-  schemaApplications.SetArray();
-  initInterestingLocations();
   return true;
 }
 
@@ -94,34 +134,51 @@ void SchemaApplicationAction::EndSourceFileAction() {
       TheRewriter.getEditBuffer(ID).write(llvm::outs());
   }
 
-  std::ofstream ofs(cfg.outputFile);
-  json::OStreamWrapper osw(ofs);
-  json::Writer<json::OStreamWrapper> writer(osw);
-  schemaApplications.Accept(writer);
 }
 
 std::unique_ptr<ASTConsumer> SchemaApplicationAction::CreateASTConsumer(CompilerInstance &CI, StringRef file) {
     TheRewriter.setSourceMgr(CI.getSourceManager(), CI.getLangOpts());
-    return llvm::make_unique<SchemaApplicationASTConsumer>(TheRewriter);
+    return llvm::make_unique<SchemaApplicationASTConsumer>(TheRewriter, State);
 }
 
 
-SchemaApplicationASTConsumer::SchemaApplicationASTConsumer(Rewriter &R) : ExpressionSchemaHandler(R), IfGuardSchemaHandler(R) {
+SchemaApplicationASTConsumer::SchemaApplicationASTConsumer(Rewriter &R, TransformState &State) :
+  ExpressionSchemaHandler(R, State),
+  IfGuardSchemaHandler(R, State),
+  State(State) {
   Matcher.addMatcher(ExpressionSchemaMatcher, &ExpressionSchemaHandler);    
-  Matcher.addMatcher(IfGuardSchemaMatcher, &IfGuardSchemaHandler);
+  if (cfg.addGuards) Matcher.addMatcher(IfGuardSchemaMatcher, &IfGuardSchemaHandler);
 }
 
 void SchemaApplicationASTConsumer::HandleTranslationUnit(ASTContext &Context) {
-  Matcher.matchAST(Context);
+  State.conditionalIndex.build(*State.conditionalsPP, Context.getSourceManager());
+  if (!useProfile) {
+    Matcher.matchAST(Context);
+    return;
+  }
+  // NOTE: only statements containing profiled locations can match, the rest of the AST is skipped
+  static const vector<unsigned> noLines;
+  auto lines = interestingLines.find(State.file.fileId);
+  LineFilteredMatcher Visitor(Matcher, Context, lines != interestingLines.end() ? lines->second : noLines);
+  Visitor.TraverseDecl(Context.getTranslationUnitDecl());
 }
 
 
-IfGuardSchemaApplicationHandler::IfGuardSchemaApplicationHandler(Rewriter &Rewrite) : Rewrite(Rewrite) {}
+IfGuardSchemaApplicationHandler::IfGuardSchemaApplicationHandler(Rewriter &Rewrite, TransformState &State) :
+  Rewrite(Rewrite),
+  State(State) {}
 
 void IfGuardSchemaApplicationHandler::run(const MatchFinder::MatchResult &Result) {
   if (const Stmt *stmt = Result.Nodes.getNodeAs<clang::Stmt>(BOUND)) {
     SourceManager &srcMgr = Rewrite.getSourceMgr();
     const LangOptions &langOpts = Rewrite.getLangOpts();
+
+    if (insideMacro(stmt, srcMgr, langOpts) ||
+        State.conditionalIndex.intersects(stmt, srcMgr))
+      return;
+
+    if (!isTopLevelStatement(stmt, Result.Context))
+      return;
    
     SourceRange expandedLoc = getExpandedLoc(stmt, srcMgr);
 
@@ -130,21 +187,27 @@ void IfGuardSchemaApplicationHandler::run(const MatchFinder::MatchResult &Result
     unsigned endLine = srcMgr.getExpansionLineNumber(expandedLoc.getEnd());
     unsigned endColumn = srcMgr.getExpansionColumnNumber(expandedLoc.getEnd());
 
-    Location current{cfg.fileId, beginLine, beginColumn, endLine, endColumn};
-    if (alreadyMatched.count(current))
+    if (!inRange(State.file, beginLine))
       return;
-    alreadyMatched.insert(current);
+
+    Location current{State.file.fileId, beginLine, beginColumn, endLine, endColumn};
+    if (State.alreadyMatched.count(current))
+      return;
+    State.alreadyMatched.insert(current);
 
     // NOTE: to avoid extracting locations from headers:
     std::pair<FileID, unsigned> decLoc = srcMgr.getDecomposedExpansionLoc(expandedLoc.getBegin());
     if (srcMgr.getMainFileID() != decLoc.first)
       return;
 
-    if (!isInterestingLocation(cfg.fileId, beginLine, beginColumn, endLine, endColumn))
+    if (!isInterestingLocation(State.file.fileId, beginLine, beginColumn, endLine, endColumn))
       return;
     
-    unsigned long appId = f1xapp(cfg.baseAppId, cfg.fileId);
-    cfg.baseAppId++;
+    unsigned long index = State.profiledLocations.size();
+    State.profiledLocations.push_back(current);
+
+    unsigned long appId = f1xapp(State.baseAppId, State.file.fileId);
+    State.baseAppId++;
                  
     llvm::errs() << beginLine << " "
                  << beginColumn << " "
@@ -154,25 +217,25 @@ void IfGuardSchemaApplicationHandler::run(const MatchFinder::MatchResult &Result
                  << toString(stmt) << "\n";
 
     json::Value app(json::kObjectType);
-    app.AddMember("schema", json::Value().SetString("if_guard"), schemaApplications.GetAllocator());
+    app.AddMember("schema", json::Value().SetString("if_guard"), State.schemaApplications.GetAllocator());
     json::Value exprJSON(json::kObjectType);
-    exprJSON.AddMember("kind", json::Value().SetString("constant"), schemaApplications.GetAllocator());
-    exprJSON.AddMember("type", json::Value().SetString("integer"), schemaApplications.GetAllocator());
-    exprJSON.AddMember("rawType", json::Value().SetString("int"), schemaApplications.GetAllocator());
-    exprJSON.AddMember("repr", json::Value().SetString("1"), schemaApplications.GetAllocator());
-    app.AddMember("expression", exprJSON, schemaApplications.GetAllocator());
-    app.AddMember("appId", json::Value().SetInt(appId), schemaApplications.GetAllocator());
-    json::Value locJSON = locToJSON(cfg.fileId, beginLine, beginColumn, endLine, endColumn, schemaApplications.GetAllocator());
-    app.AddMember("location", locJSON, schemaApplications.GetAllocator());
-    app.AddMember("context", json::Value().SetString("condition"), schemaApplications.GetAllocator());
+    exprJSON.AddMember("kind", json::Value().SetString("constant"), State.schemaApplications.GetAllocator());
+    exprJSON.AddMember("type", json::Value().SetString("integer"), State.schemaApplications.GetAllocator());
+    exprJSON.AddMember("rawType", json::Value().SetString("int"), State.schemaApplications.GetAllocator());
+    exprJSON.AddMember("repr", json::Value().SetString("1"), State.schemaApplications.GetAllocator());
+    app.AddMember("expression", exprJSON, State.schemaApplications.GetAllocator());
+    app.AddMember("appId", json::Value().SetInt(appId), State.schemaApplications.GetAllocator());
+    json::Value locJSON = locToJSON(State.file.fileId, beginLine, beginColumn, endLine, endColumn, State.schemaApplications.GetAllocator());
+    app.AddMember("location", locJSON, State.schemaApplications.GetAllocator());
+    app.AddMember("context", json::Value().SetString("condition"), State.schemaApplications.GetAllocator());
     json::Value componentsJSON(json::kArrayType);    
-    vector<json::Value> components = collectComponents(stmt, beginLine, Result.Context, schemaApplications.GetAllocator());
+    vector<json::Value> components = collectComponents(stmt, beginLine, Result.Context, State.scopeIndex, State.schemaApplications.GetAllocator());
     string arguments = makeArgumentList(components);
     for (auto &component : components) {
-      componentsJSON.PushBack(component, schemaApplications.GetAllocator());
+      componentsJSON.PushBack(component, State.schemaApplications.GetAllocator());
     }
-    app.AddMember("components", componentsJSON, schemaApplications.GetAllocator());
-    schemaApplications.PushBack(app, schemaApplications.GetAllocator());
+    app.AddMember("components", componentsJSON, State.schemaApplications.GetAllocator());
+    State.schemaApplications.PushBack(app, State.schemaApplications.GetAllocator());
 
 	  unsigned long origLength = Rewrite.getRangeSize(expandedLoc);
     std::ostringstream stringStream;
@@ -182,10 +245,12 @@ void IfGuardSchemaApplicationHandler::run(const MatchFinder::MatchResult &Result
     	stringStream << "{ ";
 
     //FIXME: should I use location or appid for the runtime function name?
-    stringStream << "if ("
+    // NOTE: __f1x_trace records profile or execution signature, depending on the loaded runtime,
+    // and requests __f1x_observe only when the profiling runtime records values
+    stringStream << "if ((__f1x_tracing && __f1x_trace(" << State.file.fileId << ", " << index << ") && "
+                 << makeObservationCall(appId, arguments) << ") || "
                  << "!(__f1xapp == " << appId << "ul) || "
-                 << "__f1x_" << cfg.fileId << "_" << beginLine << "_" << beginColumn << "_" << endLine << "_" << endColumn
-                 << "(" << arguments << ")"
+                 << makeRuntimeCall(appId, arguments)
                  << ") "
                  << toString(stmt);
 
@@ -211,13 +276,19 @@ void IfGuardSchemaApplicationHandler::run(const MatchFinder::MatchResult &Result
 }
 
 
-ExpressionSchemaApplicationHandler::ExpressionSchemaApplicationHandler(Rewriter &Rewrite) : Rewrite(Rewrite) {}
+ExpressionSchemaApplicationHandler::ExpressionSchemaApplicationHandler(Rewriter &Rewrite, TransformState &State) :
+  Rewrite(Rewrite),
+  State(State) {}
 
 void ExpressionSchemaApplicationHandler::run(const MatchFinder::MatchResult &Result) {
   if (const Expr *expr = Result.Nodes.getNodeAs<clang::Expr>(BOUND)) {
     SourceManager &srcMgr = Rewrite.getSourceMgr();
     const LangOptions &langOpts = Rewrite.getLangOpts();
 
+    if (insideMacro(expr, srcMgr, langOpts) ||
+        State.conditionalIndex.intersects(expr, srcMgr))
+      return;
+
     SourceRange expandedLoc = getExpandedLoc(expr, srcMgr);
 
     unsigned beginLine = srcMgr.getExpansionLineNumber(expandedLoc.getBegin());
@@ -225,21 +296,27 @@ void ExpressionSchemaApplicationHandler::run(const MatchFinder::MatchResult &Res
     unsigned endLine = srcMgr.getExpansionLineNumber(expandedLoc.getEnd());
     unsigned endColumn = srcMgr.getExpansionColumnNumber(expandedLoc.getEnd());
 
-    Location current{cfg.fileId, beginLine, beginColumn, endLine, endColumn};
-    if (alreadyMatched.count(current))
+    if (!inRange(State.file, beginLine))
+      return;
+
+    Location current{State.file.fileId, beginLine, beginColumn, endLine, endColumn};
+    if (State.alreadyMatched.count(current))
       return;
-    alreadyMatched.insert(current);
+    State.alreadyMatched.insert(current);
 
     // NOTE: to avoid extracting locations from headers:
     std::pair<FileID, unsigned> decLoc = srcMgr.getDecomposedExpansionLoc(expandedLoc.getBegin());
     if (srcMgr.getMainFileID() != decLoc.first)
       return;
 
-    if (!isInterestingLocation(cfg.fileId, beginLine, beginColumn, endLine, endColumn))
+    if (!isInterestingLocation(State.file.fileId, beginLine, beginColumn, endLine, endColumn))
       return;
 
-    unsigned long appId = f1xapp(cfg.baseAppId, cfg.fileId);
-    cfg.baseAppId++;
+    unsigned long index = State.profiledLocations.size();
+    State.profiledLocations.push_back(current);
+
+    unsigned long appId = f1xapp(State.baseAppId, State.file.fileId);
+    State.baseAppId++;
 
     llvm::errs() << beginLine << " "
                  << beginColumn << " "
@@ -249,33 +326,36 @@ void ExpressionSchemaApplicationHandler::run(const MatchFinder::MatchResult &Res
                  << toString(expr) << "\n";
 
     json::Value app(json::kObjectType);
-    app.AddMember("schema", json::Value().SetString("expression"), schemaApplications.GetAllocator());
-    json::Value exprJSON = stmtToJSON(expr, schemaApplications.GetAllocator());
-    app.AddMember("expression", exprJSON, schemaApplications.GetAllocator());
-    app.AddMember("appId", json::Value().SetInt(appId), schemaApplications.GetAllocator());
-    json::Value locJSON = locToJSON(cfg.fileId, beginLine, beginColumn, endLine, endColumn, schemaApplications.GetAllocator());
-    app.AddMember("location", locJSON, schemaApplications.GetAllocator());
+    app.AddMember("schema", json::Value().SetString("expression"), State.schemaApplications.GetAllocator());
+    json::Value exprJSON = stmtToJSON(expr, State.schemaApplications.GetAllocator());
+    // NOTE: the runtime returns values as unsigned long, pointers are returned as void*
+    string outputType = (string(exprJSON["type"].GetString()) == "pointer" ? "void*" : exprJSON["rawType"].GetString());
+    app.AddMember("expression", exprJSON, State.schemaApplications.GetAllocator());
+    app.AddMember("appId", json::Value().SetInt(appId), State.schemaApplications.GetAllocator());
+    json::Value locJSON = locToJSON(State.file.fileId, beginLine, beginColumn, endLine, endColumn, State.schemaApplications.GetAllocator());
+    app.AddMember("location", locJSON, State.schemaApplications.GetAllocator());
     json::Value context;
     if (inConditionContext(expr, Result.Context)) {
       context = json::Value().SetString("condition");
     } else {
       context = json::Value().SetString("unknown");
     }
-    app.AddMember("context", context, schemaApplications.GetAllocator());
+    app.AddMember("context", context, State.schemaApplications.GetAllocator());
     json::Value componentsJSON(json::kArrayType);
-    vector<json::Value> components = collectComponents(expr, beginLine, Result.Context, schemaApplications.GetAllocator());
+    vector<json::Value> components = collectComponents(expr, beginLine, Result.Context, State.scopeIndex, State.schemaApplications.GetAllocator());
     string arguments = makeArgumentList(components);
     for (auto &component : components) {
-      componentsJSON.PushBack(component, schemaApplications.GetAllocator());
+      componentsJSON.PushBack(component, State.schemaApplications.GetAllocator());
     }
-    app.AddMember("components", componentsJSON, schemaApplications.GetAllocator());
-    schemaApplications.PushBack(app, schemaApplications.GetAllocator());
+    app.AddMember("components", componentsJSON, State.schemaApplications.GetAllocator());
+    State.schemaApplications.PushBack(app, State.schemaApplications.GetAllocator());
     
     std::ostringstream stringStream;
-    stringStream << "(__f1xapp == " << appId << "ul ? "
-                 << "__f1x_" << cfg.fileId << "_" << beginLine << "_" << beginColumn << "_" << endLine << "_" << endColumn
-                 << "(" << arguments << ")"
-                 << " : " << toString(expr) << ")";
+    stringStream << "((__f1x_tracing && __f1x_trace(" << State.file.fileId << ", " << index << ") && "
+                 << makeObservationCall(appId, arguments) << "), "
+                 << "(__f1xapp == " << appId << "ul ? "
+                 << "(" << outputType << ") " << makeRuntimeCall(appId, arguments)
+                 << " : " << toString(expr) << "))";
     string replacement = stringStream.str();
 
     Rewrite.ReplaceText(expandedLoc, replacement);
@@ -28,34 +28,56 @@
 #include "clang/Lex/Preprocessor.h"
 #include "clang/Lex/PPCallbacks.h"
 
+#include "TransformUtil.h"
+
 using namespace clang;
 using namespace ast_matchers;
 
+/*
+  Loads locations from the profile; must be called before transforming translation units.
+  If profileFile is empty, all locations are instrumented. The profile is given only in the command-line mode
+  (-profile), the server always instruments all locations.
+ */
+void initInterestingLocations(const std::string &profileFile);
+
+/*
+  Writes instrumented locations of all translation units, one per line: "fileId index beginLine beginColumn endLine endColumn".
+  The index of a location is passed to __f1x_trace when the location is executed.
+ */
+bool saveProfiledLocations(const std::vector<std::unique_ptr<TransformState>> &states, const std::string &outputFile);
+
+/*
+  Writes schema applications of all translation units in the order of states into a single JSON file
+ */
+bool saveSchemaApplications(const std::vector<std::unique_ptr<TransformState>> &states, const std::string &outputFile);
+
 class IfGuardSchemaApplicationHandler : public MatchFinder::MatchCallback {
 public:
-  IfGuardSchemaApplicationHandler(Rewriter &Rewrite);
+  IfGuardSchemaApplicationHandler(Rewriter &Rewrite, TransformState &State);
 
   virtual void run(const MatchFinder::MatchResult &Result);
 
 private:
   Rewriter &Rewrite;
+  TransformState &State;
 };
 
 
 class ExpressionSchemaApplicationHandler : public MatchFinder::MatchCallback {
 public:
-  ExpressionSchemaApplicationHandler(Rewriter &Rewrite);
+  ExpressionSchemaApplicationHandler(Rewriter &Rewrite, TransformState &State);
 
   virtual void run(const MatchFinder::MatchResult &Result);
 
 private:
   Rewriter &Rewrite;
+  TransformState &State;
 };
 
 
 class SchemaApplicationASTConsumer : public ASTConsumer {
 public:
-  SchemaApplicationASTConsumer(Rewriter &R);
+  SchemaApplicationASTConsumer(Rewriter &R, TransformState &State);
 
   void HandleTranslationUnit(ASTContext &Context) override;
 
@@ -63,12 +85,13 @@ private:
   ExpressionSchemaApplicationHandler ExpressionSchemaHandler;
   IfGuardSchemaApplicationHandler IfGuardSchemaHandler;
   MatchFinder Matcher;
+  TransformState &State;
 };
 
 
 class SchemaApplicationAction : public ASTFrontendAction {
 public:
-  SchemaApplicationAction() {}
+  SchemaApplicationAction(TransformState &State) : State(State) {}
 
   bool BeginSourceFileAction(CompilerInstance &CI, StringRef Filename) override;
 
@@ -78,4 +101,5 @@ public:
 
 private:
   Rewriter TheRewriter;
+  TransformState &State;
 };
@@ -21,20 +21,21 @@
 
 
 struct Config cfg = {
-  /* fileId              = */ 0,
-  /* fromLine            = */ 0,
-  /* toLine              = */ 0,
+  /* files               = */ {},
+  /* jobs                = */ 1,
+  /* pchDir              = */ "",
   /* profileFile         = */ "",
   /* outputFile          = */ "",
+  /* locationsFile       = */ "",
   /* beginLine           = */ 0,
   /* beginColumn         = */ 0,
   /* endLine             = */ 0,
   /* endColumn           = */ 0,
   /* patch               = */ "",
-  /* baseAppId           = */ 0,
   /* useGlobalVariables  = */ false,
   /* addGuards           = */ true,
-  /* inplaceModification = */ true
+  /* inplaceModification = */ true,
+  /* maxComponents       = */ 0
 };
 
 
@@ -19,24 +19,37 @@
 #pragma once
 
 
+#include <string>
+#include <vector>
+
 #include "Config.h"
 
 
-struct Config {
+// (!fromLine && !toLine) means no restriction
+struct TransformedFile {
+  std::string path;
   unsigned fileId;
   unsigned fromLine;
   unsigned toLine;
+};
+
+
+struct Config {
+  std::vector<TransformedFile> files;
+  unsigned jobs;
+  std::string pchDir;
   std::string profileFile;
   std::string outputFile;
+  std::string locationsFile;
   unsigned beginLine;
   unsigned beginColumn;
   unsigned endLine;
   unsigned endColumn;
   std::string patch;
-  unsigned long baseAppId;
   bool useGlobalVariables;
   bool addGuards;
   bool inplaceModification;
+  unsigned maxComponents;
 };
 
 
@@ -0,0 +1,287 @@
+/*
+  This file is part of f1x.
+  Copyright (C) 2016  Sergey Mechtaev, Gao Xiang, Shin Hwei Tan, Abhik Roychoudhury
+
+  f1x is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include "clang/Basic/FileSystemOptions.h"
+#include "clang/Basic/LangOptions.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Frontend/FrontendActions.h"
+#include "clang/Lex/Lexer.h"
+#include "clang/Tooling/ArgumentsAdjusters.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "TransformRunner.h"
+
+using namespace clang;
+using namespace clang::tooling;
+using namespace llvm;
+
+
+static int StaticSymbol;
+
+static std::string normalizePath(StringRef directory, StringRef file) {
+  SmallString<256> result;
+  if (sys::path::is_absolute(file)) {
+    result = file;
+  } else {
+    result = directory;
+    sys::path::append(result, file);
+  }
+  sys::path::remove_dots(result, true);
+  return result.str();
+}
+
+
+class GeneratePreambleAction : public GeneratePCHAction {
+public:
+  GeneratePreambleAction(const std::string &output) : output(output) {}
+
+protected:
+  bool BeginInvocation(CompilerInstance &CI) override {
+    CI.getFrontendOpts().OutputFile = output;
+    return true;
+  }
+
+private:
+  std::string output;
+};
+
+
+TransformRunner::TransformRunner(const CompilationDatabase &compilations, unsigned jobs, const std::string &pchDir):
+  compilations(compilations),
+  jobs(jobs ? jobs : 1),
+  pchDir(pchDir),
+  fileManagers(this->jobs) {
+  if (!pchDir.empty())
+    sys::fs::create_directories(pchDir);
+}
+
+bool TransformRunner::getCommand(const std::string &file, Command &command) {
+  std::string path = getAbsolutePath(file);
+  auto cached = commands.find(path);
+  if (cached != commands.end()) {
+    command = cached->second;
+    return true;
+  }
+
+  std::vector<CompileCommand> compileCommands = compilations.getCompileCommands(path);
+  if (compileCommands.empty()) {
+    errs() << "error: no compile command for " << path << "\n";
+    return false;
+  }
+  // NOTE: similarly to the previous invocation per file, only the first command is used
+  const CompileCommand &compileCommand = compileCommands.front();
+
+  ArgumentsAdjuster adjuster = combineAdjusters(getClangStripOutputAdjuster(), getClangSyntaxOnlyAdjuster());
+  command.path = normalizePath("", path);
+  command.directory = compileCommand.Directory;
+  command.commandLine = adjuster(compileCommand.CommandLine);
+  command.commandLine[0] = sys::fs::getMainExecutable("f1x-transform", &StaticSymbol);
+  // NOTE: the main file is referred to by its absolute path, so that its cache entry has a single name
+  command.mainIndex = 0;
+  for (unsigned i = 1; i < command.commandLine.size(); i++) {
+    std::string &arg = command.commandLine[i];
+    if (!arg.empty() && arg[0] != '-' && normalizePath(command.directory, arg) == command.path) {
+      arg = command.path;
+      command.mainIndex = i;
+    }
+  }
+  // other relative paths are resolved by the driver against this directory instead of the current one:
+  command.commandLine.push_back("-working-directory=" + command.directory);
+
+  commands[path] = command;
+  return true;
+}
+
+static void invalidateFile(FileManager &files, StringRef path) {
+  if (const FileEntry *entry = files.getFile(path, /*openFile=*/false, /*CacheFailure=*/false))
+    files.invalidateCache(entry);
+}
+
+/*
+  The preamble of a translation unit (leading preprocessor directives and comments) is precompiled once
+  for each distinct compile command and preamble, and stored in pchDir. The main file is then parsed with
+  this PCH, skipping its preamble bytes, similarly to how libclang reparses translation units.
+  Since the preamble does not contain code, this does not affect transformed locations.
+ */
+bool TransformRunner::preparePreamble(const Command &command,
+                                      StringRef source,
+                                      FileManager &files,
+                                      std::vector<std::string> &preambleArgs) {
+  if (pchDir.empty() || !command.mainIndex)
+    return false;
+
+  LangOptions langOpts;
+  langOpts.LineComment = true;
+  std::pair<unsigned, bool> bounds = Lexer::ComputePreamble(source, langOpts);
+  if (!bounds.first)
+    return false;
+  StringRef preamble = source.substr(0, bounds.first);
+
+  std::ostringstream key;
+  for (unsigned i = 0; i < command.commandLine.size(); i++) {
+    if (i != command.mainIndex)
+      key << command.commandLine[i] << "\n";
+  }
+  key << preamble.str();
+  std::ostringstream name;
+  name << std::hex << std::hash<std::string>()(key.str());
+
+  SmallString<256> header(pchDir);
+  sys::path::append(header, name.str() + ".h");
+  SmallString<256> pch(pchDir);
+  sys::path::append(pch, name.str() + ".pch");
+
+  if (!sys::fs::exists(pch)) {
+    if (!sys::fs::exists(header)) {
+      // written to a temporary file first, since other workers can generate the same preamble
+      std::ostringstream suffix;
+      suffix << "." << std::this_thread::get_id();
+      std::string tmp = header.str().str() + suffix.str();
+      {
+        std::error_code err;
+        raw_fd_ostream out(tmp, err, sys::fs::F_None);
+        if (err)
+          return false;
+        out << preamble << "\n";
+      }
+      if (sys::fs::rename(tmp, header))
+        return false;
+    }
+
+    bool isC = sys::path::extension(command.path) == ".c";
+    std::vector<std::string> commandLine;
+    for (unsigned i = 0; i < command.commandLine.size(); i++) {
+      if (i == command.mainIndex) {
+        commandLine.push_back("-x");
+        commandLine.push_back(isC ? "c-header" : "c++-header");
+        commandLine.push_back(header.str());
+      } else {
+        commandLine.push_back(command.commandLine[i]);
+      }
+    }
+    invalidateFile(files, pch);
+    ToolInvocation invocation(commandLine, new GeneratePreambleAction(pch.str()), &files);
+    if (!invocation.run()) {
+      sys::fs::remove(pch);
+      return false;
+    }
+  }
+  invalidateFile(files, pch);
+
+  preambleArgs.push_back("-include-pch");
+  preambleArgs.push_back(pch.str());
+  preambleArgs.push_back("-Xclang");
+  preambleArgs.push_back("-preamble-bytes=" + std::to_string(bounds.first) + "," + (bounds.second ? "1" : "0"));
+  return true;
+}
+
+bool TransformRunner::transformFile(const Command &command,
+                                    TransformState &state,
+                                    const TransformActionFactory &makeAction,
+                                    FileManagers &workerFileManagers) {
+  IntrusiveRefCntPtr<FileManager> &files = workerFileManagers[command.directory];
+  if (!files) {
+    FileSystemOptions options;
+    options.WorkingDir = command.directory;
+    files = new FileManager(options);
+  }
+
+  // NOTE: the main file is modified between runs (instrumented, restored), so its cached size must not be reused
+  invalidateFile(*files, command.path);
+
+  std::vector<std::string> preambleArgs;
+  ErrorOr<std::unique_ptr<MemoryBuffer>> source = MemoryBuffer::getFile(command.path);
+  if (source && preparePreamble(command, (*source)->getBuffer(), *files, preambleArgs)) {
+    std::vector<std::string> commandLine = command.commandLine;
+    commandLine.insert(commandLine.end(), preambleArgs.begin(), preambleArgs.end());
+    ToolInvocation invocation(commandLine, makeAction(state), files.get());
+    if (invocation.run())
+      return true;
+
+    // a stale PCH (e.g. headers changed) fails before the main file is rewritten, so it is safe to retry without it;
+    // otherwise, the error is in the main file itself
+    invalidateFile(*files, command.path);
+    ErrorOr<std::unique_ptr<MemoryBuffer>> current = MemoryBuffer::getFile(command.path);
+    if (!current || (*current)->getBuffer() != (*source)->getBuffer()) {
+      errs() << "error: failed to transform " << command.path << "\n";
+      return false;
+    }
+    sys::fs::remove(preambleArgs[1]);
+    state.reset();
+  }
+
+  ToolInvocation invocation(command.commandLine, makeAction(state), files.get());
+  if (!invocation.run()) {
+    errs() << "error: failed to transform " << command.path << "\n";
+    return false;
+  }
+  return true;
+}
+
+bool TransformRunner::run(std::vector<std::unique_ptr<TransformState>> &states,
+                          const TransformActionFactory &makeAction) {
+  bool success = true;
+
+  // compile commands are looked up before starting workers, since the database is not thread-safe
+  std::vector<Command> stateCommands(states.size());
+  std::vector<bool> found(states.size());
+  for (unsigned long i = 0; i < states.size(); i++) {
+    found[i] = getCommand(states[i]->file.path, stateCommands[i]);
+    if (!found[i])
+      success = false;
+  }
+
+  std::atomic<unsigned long> next(0);
+  std::atomic<bool> workersSuccess(true);
+
+  auto worker = [&](unsigned workerId) {
+    unsigned long index;
+    while ((index = next++) < states.size()) {
+      if (!found[index])
+        continue;
+      if (!transformFile(stateCommands[index], *states[index], makeAction, fileManagers[workerId]))
+        workersSuccess = false;
+    }
+  };
+
+  unsigned numWorkers = std::min<unsigned long>(jobs, states.size());
+  if (numWorkers <= 1) {
+    worker(0);
+  } else {
+    std::vector<std::thread> pool;
+    for (unsigned i = 0; i < numWorkers; i++)
+      pool.push_back(std::thread(worker, i));
+    for (auto &t : pool)
+      t.join();
+  }
+
+  return success && workersSuccess;
+}
@@ -0,0 +1,76 @@
+/*
+  This file is part of f1x.
+  Copyright (C) 2016  Sergey Mechtaev, Gao Xiang, Shin Hwei Tan, Abhik Roychoudhury
+
+  f1x is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "clang/Basic/FileManager.h"
+#include "clang/Frontend/FrontendAction.h"
+#include "clang/Tooling/CompilationDatabase.h"
+
+#include "TransformUtil.h"
+
+
+typedef std::function<clang::FrontendAction *(TransformState &)> TransformActionFactory;
+
+/*
+  Runs a separate action for each translation unit in a pool of jobs threads.
+  In contrast with ClangTool::run, it does not change the working directory of the process.
+  Compile commands and file managers (and therefore their caches of header lookups) are kept between runs,
+  so that the same runner can be used for several transformations of the same files.
+  If pchDir is not empty, preambles of translation units are precompiled there and reused (see preparePreamble).
+ */
+class TransformRunner {
+public:
+  TransformRunner(const clang::tooling::CompilationDatabase &compilations, unsigned jobs, const std::string &pchDir = "");
+
+  /* returns false if any translation unit failed */
+  bool run(std::vector<std::unique_ptr<TransformState>> &states, const TransformActionFactory &makeAction);
+
+private:
+  struct Command {
+    std::string path; // absolute path of the main file
+    std::string directory;
+    std::vector<std::string> commandLine;
+    unsigned mainIndex; // position of the main file in the command line, 0 if not found
+  };
+
+  typedef std::map<std::string, llvm::IntrusiveRefCntPtr<clang::FileManager>> FileManagers;
+
+  const clang::tooling::CompilationDatabase &compilations;
+  unsigned jobs;
+  std::string pchDir;
+  std::map<std::string, Command> commands;
+  std::vector<FileManagers> fileManagers; // file managers are not thread-safe, so each worker owns its own
+
+  bool getCommand(const std::string &file, Command &command);
+  bool preparePreamble(const Command &command,
+                       llvm::StringRef source,
+                       clang::FileManager &files,
+                       std::vector<std::string> &preambleArgs);
+  bool transformFile(const Command &command,
+                     TransformState &state,
+                     const TransformActionFactory &makeAction,
+                     FileManagers &workerFileManagers);
+};
@@ -18,6 +18,7 @@
 
 #include <algorithm>
 #include <map>
+#include <set>
 #include <stack>
 #include <sstream>
 
@@ -45,8 +46,6 @@ const BuiltinType::Kind DEFAULT_NUMERIC_TYPE = BuiltinType::Long;
 const string DEFAULT_POINTEE_TYPE = "void";
 
 
-std::shared_ptr<std::vector<clang::SourceRange>> globalConditionalsPP = std::shared_ptr<std::vector<clang::SourceRange>>(new std::vector<clang::SourceRange>());
-
 const unsigned F1XAPP_WIDTH = 32;
 const unsigned F1XAPP_VALUE_BITS = 10;
 
@@ -64,9 +63,29 @@ unsigned long f1xapp(unsigned long baseId, unsigned fileId) {
 }
 
 
-bool inRange(unsigned line) {
-  if (cfg.fromLine || cfg.toLine) {
-    return cfg.fromLine <= line && line <= cfg.toLine;
+TransformState::TransformState(const TransformedFile &file):
+  file(file),
+  baseAppId(0),
+  alreadyTransformed(false),
+  conditionalsPP(new std::vector<SourceRange>()) {
+  schemaApplications.SetArray();
+}
+
+void TransformState::reset() {
+  baseAppId = 0;
+  alreadyTransformed = false;
+  alreadyMatched.clear();
+  conditionalsPP->clear();
+  conditionalIndex.clear();
+  schemaApplications.SetArray();
+  scopeIndex.clear();
+  profiledLocations.clear();
+}
+
+
+bool inRange(const TransformedFile &file, unsigned line) {
+  if (file.fromLine || file.toLine) {
+    return file.fromLine <= line && line <= file.toLine;
   } else {
     return true;
   }
@@ -108,33 +127,90 @@ void PPConditionalRecoder::Endif(SourceLocation Loc, SourceLocation IfLoc) {
 }
 
 
-bool intersectConditionalPP(const Stmt* stmt, 
-                            SourceManager &srcMgr, 
-                            const std::shared_ptr<std::vector<SourceRange>> conditionalsPP) {
-  BeforeThanCompare<SourceLocation> isBefore(srcMgr);
+void ConditionalIndex::RangeTable::build(const vector<unsigned> &values, bool maximum) {
+  this->maximum = maximum;
+  levels.clear();
+  levels.push_back(values);
+  for (unsigned width = 2; width <= values.size(); width *= 2) {
+    const vector<unsigned> &previous = levels.back();
+    vector<unsigned> level;
+    for (unsigned i = 0; i + width <= values.size(); i++) {
+      unsigned a = previous[i];
+      unsigned b = previous[i + width / 2];
+      level.push_back(maximum ? std::max(a, b) : std::min(a, b));
+    }
+    levels.push_back(std::move(level));
+  }
+}
+
+unsigned ConditionalIndex::RangeTable::query(unsigned from, unsigned to) const {
+  unsigned k = 0;
+  while ((2u << k) <= to - from)
+    k++;
+  unsigned a = levels[k][from];
+  unsigned b = levels[k][to - (1u << k)];
+  return maximum ? std::max(a, b) : std::min(a, b);
+}
+
 
-  for (auto range : *conditionalsPP) {
+void ConditionalIndex::clear() {
+  begins.clear();
+  ends.clear();
+}
+
+void ConditionalIndex::build(const vector<SourceRange> &conditionals, SourceManager &srcMgr) {
+  vector<pair<unsigned, unsigned>> ranges;
+  for (auto &range : conditionals) {
     // only in the main file:
-    std::pair<FileID, unsigned> decLoc = srcMgr.getDecomposedExpansionLoc(range.getBegin());
-    if (srcMgr.getMainFileID() != decLoc.first)
+    std::pair<FileID, unsigned> decBegin = srcMgr.getDecomposedExpansionLoc(range.getBegin());
+    if (srcMgr.getMainFileID() != decBegin.first)
       continue;
+    std::pair<FileID, unsigned> decEnd = srcMgr.getDecomposedExpansionLoc(range.getEnd());
+    ranges.push_back(std::make_pair(decBegin.second, decEnd.second));
+  }
 
-    /*
-      Matching situation like this (and the opposite):
-      EXPR_BEGIN
-      #ifdef
-      EXPR_END
-      #endif
-     */
-    if ((isBefore(stmt->getLocStart(), range.getBegin()) &&
-         isBefore(range.getBegin(), stmt->getLocEnd()) &&
-         isBefore(stmt->getLocEnd(), range.getEnd())) || 
-        (isBefore(range.getBegin(), stmt->getLocStart()) && 
-         isBefore(stmt->getLocStart(), range.getEnd()) && 
-         isBefore(range.getEnd(), stmt->getLocEnd()))) {
-      return true;
-    }
+  std::sort(ranges.begin(), ranges.end());
+  begins.clear();
+  vector<unsigned> endsByBegin;
+  for (auto &range : ranges) {
+    begins.push_back(range.first);
+    endsByBegin.push_back(range.second);
   }
+  maxEndByBegin.build(endsByBegin, true);
+
+  std::sort(ranges.begin(), ranges.end(),
+            [](const pair<unsigned, unsigned> &a, const pair<unsigned, unsigned> &b) { return a.second < b.second; });
+  ends.clear();
+  vector<unsigned> beginsByEnd;
+  for (auto &range : ranges) {
+    ends.push_back(range.second);
+    beginsByEnd.push_back(range.first);
+  }
+  minBeginByEnd.build(beginsByEnd, false);
+}
+
+bool ConditionalIndex::intersects(const Stmt *stmt, SourceManager &srcMgr) const {
+  if (begins.empty())
+    return false;
+
+  std::pair<FileID, unsigned> decBegin = srcMgr.getDecomposedExpansionLoc(stmt->getLocStart());
+  std::pair<FileID, unsigned> decEnd = srcMgr.getDecomposedExpansionLoc(stmt->getLocEnd());
+  if (srcMgr.getMainFileID() != decBegin.first || srcMgr.getMainFileID() != decEnd.first)
+    return false;
+  unsigned stmtBegin = decBegin.second;
+  unsigned stmtEnd = decEnd.second;
+
+  // conditional begins inside the statement and ends after it:
+  unsigned from = std::upper_bound(begins.begin(), begins.end(), stmtBegin) - begins.begin();
+  unsigned to = std::lower_bound(begins.begin(), begins.end(), stmtEnd) - begins.begin();
+  if (from < to && maxEndByBegin.query(from, to) > stmtEnd)
+    return true;
+
+  // conditional ends inside the statement and begins before it:
+  from = std::upper_bound(ends.begin(), ends.end(), stmtBegin) - ends.begin();
+  to = std::lower_bound(ends.begin(), ends.end(), stmtEnd) - ends.begin();
+  if (from < to && minBeginByEnd.query(from, to) < stmtBegin)
+    return true;
 
   return false;
 }
@@ -163,6 +239,35 @@ SourceRange getExpandedLoc(const Stmt* expr, SourceManager &srcMgr) {
 }
 
 
+LineFilteredMatcher::LineFilteredMatcher(ast_matchers::MatchFinder &Finder,
+                                         ASTContext &Context,
+                                         const vector<unsigned> &Lines):
+  Finder(Finder),
+  Context(Context),
+  Lines(Lines) {}
+
+bool LineFilteredMatcher::TraverseStmt(Stmt *S) {
+  if (!S)
+    return true;
+
+  SourceManager &srcMgr = Context.getSourceManager();
+  SourceRange expandedLoc = getExpandedLoc(S, srcMgr);
+  // NOTE: statements without location (implicit code) are not matched, but their children are
+  if (expandedLoc.getBegin().isValid() && expandedLoc.getEnd().isValid()) {
+    if (!srcMgr.isInMainFile(expandedLoc.getBegin()))
+      return true;
+    unsigned beginLine = srcMgr.getExpansionLineNumber(expandedLoc.getBegin());
+    unsigned endLine = srcMgr.getExpansionLineNumber(expandedLoc.getEnd());
+    auto line = std::lower_bound(Lines.begin(), Lines.end(), beginLine);
+    if (line == Lines.end() || *line > endLine)
+      return true;
+    Finder.match(*S, Context);
+  }
+
+  return RecursiveASTVisitor<LineFilteredMatcher>::TraverseStmt(S);
+}
+
+
 string toString(const Stmt *stmt) {
   /* Special case for break and continue statement
      Reason: There were semicolon ; and newline found
@@ -193,7 +298,10 @@ bool overwriteMainChangedFile(Rewriter &TheRewriter) {
   std::error_code err_code;
   auto buffer = TheRewriter.getRewriteBufferFor(id);
   if (buffer) {// if there are modifications
-    raw_fd_ostream out(Entry->getName(), err_code, sys::fs::F_None);
+    // NOTE: the working directory of the file manager can differ from the current one
+    SmallString<256> path(Entry->getName());
+    TheRewriter.getSourceMgr().getFileManager().FixupRelativePath(path);
+    raw_fd_ostream out(path, err_code, sys::fs::F_None);
     buffer->write(out);
     out.close();
   }
@@ -691,134 +799,214 @@ json::Value varDeclToJSON(VarDecl *vd, json::Document::AllocatorType &allocator)
 }
 
 
-vector<json::Value> collectVisible(const ast_type_traits::DynTypedNode &node,
-                                   unsigned line,
-                                   ASTContext* context,
-                                   json::Document::AllocatorType &allocator) {
-  vector<json::Value> result;
+ScopeIndex::ScopeIndex() {
+  storage.SetArray();
+}
 
-  const FunctionDecl* fd;
-  if ((fd = node.get<FunctionDecl>()) != NULL) {
+void ScopeIndex::clear() {
+  compounds.clear();
+  functions.clear();
+  storage.SetArray();
+}
 
-    // adding function parameters
-    for (auto it = fd->param_begin(); it != fd->param_end(); ++it) {
-      auto vd = cast<VarDecl>(*it);
-      if (isSuitableComponentType(vd->getType())) {
-        result.push_back(varDeclToJSON(vd, allocator));
+/*
+  Components of a compound statement are collected from its statements, each of them is visible after its first line:
+  - variables assigned by assignments
+  - variables declared with initialization
+  - components of statements
+ */
+ScopeIndex::Scope &ScopeIndex::getCompound(const CompoundStmt *cstmt, ASTContext *context) {
+  auto cached = compounds.find(cstmt);
+  if (cached != compounds.end())
+    return cached->second;
+
+  json::Document::AllocatorType &allocator = storage.GetAllocator();
+  Scope &scope = compounds[cstmt];
+  scope.sortedByLine = true;
+  for (auto it = cstmt->body_begin(); it != cstmt->body_end(); ++it) {
+    Stmt* stmt = cast<Stmt>(*it);
+    SourceRange expandedLoc = getExpandedLoc(stmt, context->getSourceManager());
+    unsigned beginLine = context->getSourceManager().getExpansionLineNumber(expandedLoc.getBegin());
+    if (!scope.entries.empty() && scope.entries.back().line > beginLine)
+      scope.sortedByLine = false; // e.g. statements from included files
+
+    if (isa<BinaryOperator>(*it)) {
+      BinaryOperator* op = cast<BinaryOperator>(*it);
+      // FIXME: support declarations with initialization
+      // FIXME: support augmented assignments:
+      // FIXME: is it redundant if we use collect funnction on whole statement
+      if (BinaryOperator::getOpcodeStr(op->getOpcode()).lower() == "=" &&
+          isa<DeclRefExpr>(op->getLHS())) {
+        DeclRefExpr* dref = cast<DeclRefExpr>(op->getLHS());
+        VarDecl* vd;
+        if ((vd = cast<VarDecl>(dref->getDecl())) != NULL && isSuitableComponentType(vd->getType())) {
+          scope.entries.push_back(Entry{beginLine, varDeclToJSON(vd, allocator)});
+        }
       }
     }
 
-    if (cfg.useGlobalVariables) {
-      auto parents = context->getParents(node);
-      if (parents.size() > 0) {
-        const ast_type_traits::DynTypedNode parent = *(parents.begin()); // FIXME: for now only first
-        const TranslationUnitDecl* tu;
-        if ((tu = parent.get<TranslationUnitDecl>()) != NULL) {
-          for (auto it = tu->decls_begin(); it != tu->decls_end(); ++it) {
-            if (isa<VarDecl>(*it)) {
-              VarDecl* vd = cast<VarDecl>(*it);
-              unsigned beginLine = getDeclExpandedLine(vd, context->getSourceManager());
-              if (line > beginLine && isSuitableComponentType(vd->getType())) {
-                result.push_back(varDeclToJSON(vd, allocator));
-              }
-            }
+    if (isa<DeclStmt>(*it)) {
+      DeclStmt* dstmt = cast<DeclStmt>(*it);
+      for (auto it = dstmt->decl_begin(); it != dstmt->decl_end(); ++it) {
+        Decl* d = *it;
+        if (isa<VarDecl>(d)) {
+          VarDecl* vd = cast<VarDecl>(d);
+          // NOTE: hasInit because don't want to use garbage
+          if (vd->hasInit() && isSuitableComponentType(vd->getType())) {
+            scope.entries.push_back(Entry{beginLine, varDeclToJSON(vd, allocator)});
           }
         }
       }
     }
-    
-  } else {
 
-    const CompoundStmt* cstmt;
-    if ((cstmt = node.get<CompoundStmt>()) != NULL) {
-      for (auto it = cstmt->body_begin(); it != cstmt->body_end(); ++it) {
-
-        if (isa<BinaryOperator>(*it)) {
-          BinaryOperator* op = cast<BinaryOperator>(*it);
-          SourceRange expandedLoc = getExpandedLoc(op, context->getSourceManager());
-          unsigned beginLine = context->getSourceManager().getExpansionLineNumber(expandedLoc.getBegin());
-          // FIXME: support declarations with initialization
-          // FIXME: support augmented assignments:
-          // FIXME: is it redundant if we use collect funnction on whole statement
-          if (line > beginLine &&
-              BinaryOperator::getOpcodeStr(op->getOpcode()).lower() == "=" &&
-              isa<DeclRefExpr>(op->getLHS())) {
-            DeclRefExpr* dref = cast<DeclRefExpr>(op->getLHS());
-            VarDecl* vd;
-            if ((vd = cast<VarDecl>(dref->getDecl())) != NULL && isSuitableComponentType(vd->getType())) {
-              result.push_back(varDeclToJSON(vd, allocator));
-            }
-          }
-        }
+    vector<json::Value> fromExpr = collectFromExpression(*it, allocator, true, true);
+    for (auto &c : fromExpr) {
+      scope.entries.push_back(Entry{beginLine, std::move(c)});
+    }
 
-        if (isa<DeclStmt>(*it)) {
-          DeclStmt* dstmt = cast<DeclStmt>(*it);
-          SourceRange expandedLoc = getExpandedLoc(dstmt, context->getSourceManager());
-          unsigned beginLine = context->getSourceManager().getExpansionLineNumber(expandedLoc.getBegin());
-          for (auto it = dstmt->decl_begin(); it != dstmt->decl_end(); ++it) {
-            Decl* d = *it;
-            if (isa<VarDecl>(d)) {
-              VarDecl* vd = cast<VarDecl>(d);
-              // NOTE: hasInit because don't want to use garbage
-              if (line > beginLine && vd->hasInit() && isSuitableComponentType(vd->getType())) {
-                result.push_back(varDeclToJSON(vd, allocator));
-              }
-            }
+    // FIXME: is it redundant?
+    // TODO: should be generalized for other cases:
+    if (isa<IfStmt>(*it)) {
+      IfStmt* ifStmt = cast<IfStmt>(*it);
+      Stmt* thenStmt = ifStmt->getThen();
+      if (isa<CallExpr>(*thenStmt)) {
+        CallExpr* callExpr = cast<CallExpr>(thenStmt);
+        for (auto a = callExpr->arg_begin(); a != callExpr->arg_end(); ++a) {
+          auto e = cast<Expr>(*a);
+          vector<json::Value> fromParamExpr = collectFromExpression(e, allocator, true, true);
+          for (auto &c : fromParamExpr) {
+            scope.entries.push_back(Entry{beginLine, std::move(c)});
           }
         }
+      }
+    }
+  }
+  return scope;
+}
 
-        Stmt* stmt = cast<Stmt>(*it);
-        SourceRange expandedLoc = getExpandedLoc(stmt, context->getSourceManager());
-        unsigned beginLine = context->getSourceManager().getExpansionLineNumber(expandedLoc.getBegin());
-        if (line > beginLine) {
-          vector<json::Value> fromExpr = collectFromExpression(*it, allocator, true, true);
-          for (auto &c : fromExpr) {
-            result.push_back(std::move(c));
-          }
-          
-          // FIXME: is it redundant?
-          // TODO: should be generalized for other cases:
-          if (isa<IfStmt>(*it)) {
-            IfStmt* ifStmt = cast<IfStmt>(*it);
-            Stmt* thenStmt = ifStmt->getThen();
-            if (isa<CallExpr>(*thenStmt)) {
-              CallExpr* callExpr = cast<CallExpr>(thenStmt);
-              for (auto a = callExpr->arg_begin(); a != callExpr->arg_end(); ++a) {
-                auto e = cast<Expr>(*a);
-                vector<json::Value> fromParamExpr = collectFromExpression(e, allocator, true, true);
-                for (auto &c : fromParamExpr) {
-                  result.push_back(std::move(c));
-                }
-              }
+/*
+  Components of a function are its parameters (always visible) and, optionally, global variables
+ */
+ScopeIndex::Scope &ScopeIndex::getFunction(const FunctionDecl *fd, ASTContext *context) {
+  auto cached = functions.find(fd);
+  if (cached != functions.end())
+    return cached->second;
+
+  json::Document::AllocatorType &allocator = storage.GetAllocator();
+  Scope &scope = functions[fd];
+  scope.sortedByLine = false; // global variables can come from headers
+
+  // adding function parameters
+  for (auto it = fd->param_begin(); it != fd->param_end(); ++it) {
+    auto vd = cast<VarDecl>(*it);
+    if (isSuitableComponentType(vd->getType())) {
+      scope.entries.push_back(Entry{0, varDeclToJSON(vd, allocator)});
+    }
+  }
+
+  if (cfg.useGlobalVariables) {
+    auto parents = context->getParents(*fd);
+    if (parents.size() > 0) {
+      const ast_type_traits::DynTypedNode parent = *(parents.begin()); // FIXME: for now only first
+      const TranslationUnitDecl* tu;
+      if ((tu = parent.get<TranslationUnitDecl>()) != NULL) {
+        for (auto it = tu->decls_begin(); it != tu->decls_end(); ++it) {
+          if (isa<VarDecl>(*it)) {
+            VarDecl* vd = cast<VarDecl>(*it);
+            unsigned beginLine = getDeclExpandedLine(vd, context->getSourceManager());
+            if (isSuitableComponentType(vd->getType())) {
+              scope.entries.push_back(Entry{beginLine, varDeclToJSON(vd, allocator)});
             }
           }
         }
-        
       }
     }
-    
-    auto parents = context->getParents(node);
-    if (parents.size() > 0) {
-      const ast_type_traits::DynTypedNode parent = *(parents.begin()); // TODO: for now only first
-      vector<json::Value> parentResult = collectVisible(parent, line, context, allocator);
-      for (auto &c : parentResult) {
-        result.push_back(std::move(c));
-      }
+  }
+  return scope;
+}
+
+void ScopeIndex::collect(const Scope &scope,
+                         unsigned line,
+                         bool statements,
+                         json::Document::AllocatorType &allocator,
+                         vector<VisibleComponent> &result) {
+  auto end = scope.entries.end();
+  if (scope.sortedByLine) {
+    end = std::lower_bound(scope.entries.begin(), scope.entries.end(), line,
+                           [](const Entry &entry, unsigned line) { return entry.line < line; });
+  }
+  for (auto it = scope.entries.begin(); it != end; ++it) {
+    if (line > it->line)
+      result.push_back(VisibleComponent{it->line, statements, json::Value(it->component, allocator)});
+  }
+}
+
+void ScopeIndex::collectCompound(const CompoundStmt *scope,
+                                 unsigned line,
+                                 ASTContext *context,
+                                 json::Document::AllocatorType &allocator,
+                                 vector<VisibleComponent> &result) {
+  collect(getCompound(scope, context), line, true, allocator, result);
+}
+
+void ScopeIndex::collectFunction(const FunctionDecl *scope,
+                                 unsigned line,
+                                 ASTContext *context,
+                                 json::Document::AllocatorType &allocator,
+                                 vector<VisibleComponent> &result) {
+  collect(getFunction(scope, context), line, false, allocator, result);
+}
+
+
+/*
+  Collects components visible at the line from enclosing scopes, from the innermost to the function
+ */
+vector<VisibleComponent> collectVisible(const ast_type_traits::DynTypedNode &node,
+                                        unsigned line,
+                                        ASTContext* context,
+                                        ScopeIndex &index,
+                                        json::Document::AllocatorType &allocator) {
+  vector<VisibleComponent> result;
+
+  ast_type_traits::DynTypedNode current = node;
+  while (true) {
+    const FunctionDecl* fd;
+    if ((fd = current.get<FunctionDecl>()) != NULL) {
+      index.collectFunction(fd, line, context, allocator, result);
+      break;
     }
+
+    const CompoundStmt* cstmt;
+    if ((cstmt = current.get<CompoundStmt>()) != NULL) {
+      index.collectCompound(cstmt, line, context, allocator, result);
+    }
+
+    auto parents = context->getParents(current);
+    if (parents.size() == 0)
+      break;
+    current = *(parents.begin()); // TODO: for now only first
   }
-  
+
   return result;
 }
 
 
+/*
+  Visible components are ranked by relevance to the expression:
+  1. data flow: occurring in a statement together with a component of the expression (e.g. assigned from it);
+  2. lexical proximity: distance to the closest preceding statement where the component occurs;
+  3. number of occurrences in the enclosing scopes.
+  Components of the expression are always kept, and the number of components is limited by cfg.maxComponents (0 means no limit)
+ */
 vector<json::Value> collectComponents(const Stmt *stmt,
                                       unsigned line,
                                       ASTContext *context,
+                                      ScopeIndex &index,
                                       json::Document::AllocatorType &allocator) {
   vector<json::Value> fromExpr = collectFromExpression(stmt, allocator, false, false);
 
   const ast_type_traits::DynTypedNode node = ast_type_traits::DynTypedNode::create(*stmt);
-  vector<json::Value> visible = collectVisible(node, line, context, allocator);
+  vector<VisibleComponent> visible = collectVisible(node, line, context, index, allocator);
 
   vector<json::Value> result;
 
@@ -830,17 +1018,79 @@ vector<json::Value> collectComponents(const Stmt *stmt,
     }
     if (newComponent)
       result.push_back(std::move(c));
-  }  
+  }
 
-  for (auto &c : visible) {
-    bool newComponent = true;
-    for (auto &old : result) {
-      if (c["repr"] == old["repr"])
-        newComponent = false;
+  std::set<string> exprReprs;
+  for (auto &c : result) {
+    exprReprs.insert(c["repr"].GetString());
+  }
+
+  // NOTE: statements of a scope are identified by their first lines
+  std::set<unsigned> relatedLines;
+  for (auto &v : visible) {
+    if (v.inStatement && exprReprs.count(v.component["repr"].GetString()))
+      relatedLines.insert(v.line);
+  }
+
+  struct Relevance {
+    bool related;
+    unsigned distance;
+    unsigned occurrences;
+    unsigned long order;
+  };
+
+  vector<json::Value> candidates;
+  map<string, Relevance> relevance;
+  for (auto &v : visible) {
+    string repr = v.component["repr"].GetString();
+    if (exprReprs.count(repr))
+      continue;
+    bool related = v.inStatement && relatedLines.count(v.line);
+    unsigned distance = line - v.line;
+    auto existing = relevance.find(repr);
+    if (existing == relevance.end()) {
+      relevance[repr] = Relevance{related, distance, 1, candidates.size()};
+      candidates.push_back(std::move(v.component));
+    } else {
+      existing->second.related = existing->second.related || related;
+      existing->second.distance = std::min(existing->second.distance, distance);
+      existing->second.occurrences++;
     }
-    if (newComponent)
+  }
+
+  unsigned long limit = candidates.size();
+  if (cfg.maxComponents != 0) {
+    limit = (cfg.maxComponents > result.size() ? cfg.maxComponents - result.size() : 0);
+  }
+
+  if (limit < candidates.size()) {
+    vector<const Relevance*> ranked;
+    for (auto &r : relevance) {
+      ranked.push_back(&r.second);
+    }
+    std::sort(ranked.begin(), ranked.end(), [](const Relevance *a, const Relevance *b) {
+        if (a->related != b->related)
+          return a->related;
+        if (a->distance != b->distance)
+          return a->distance < b->distance;
+        if (a->occurrences != b->occurrences)
+          return a->occurrences > b->occurrences;
+        return a->order < b->order;
+      });
+    // NOTE: selected components keep their order, so that the argument list does not depend on ranking
+    vector<bool> selected(candidates.size(), false);
+    for (unsigned long i = 0; i < limit; i++) {
+      selected[ranked[i]->order] = true;
+    }
+    for (unsigned long i = 0; i < candidates.size(); i++) {
+      if (selected[i])
+        result.push_back(std::move(candidates[i]));
+    }
+  } else {
+    for (auto &c : candidates) {
       result.push_back(std::move(c));
-  }  
+    }
+  }
 
   return result;
 }
@@ -977,3 +1227,24 @@ string makeArgumentList(vector<json::Value> &components) {
 
   return result.str();
 }
+
+
+static string makeEntryCall(const string &entry, unsigned long appId, const string &arguments) {
+  std::ostringstream result;
+  result << entry << "(" << appId << "ul, ";
+  if (arguments.empty()) {
+    result << "(void**)0";
+  } else {
+    result << "(void*[]){" << arguments << "}";
+  }
+  result << ")";
+  return result.str();
+}
+
+string makeRuntimeCall(unsigned long appId, const string &arguments) {
+  return makeEntryCall("__f1x_eval", appId, arguments);
+}
+
+string makeObservationCall(unsigned long appId, const string &arguments) {
+  return makeEntryCall("__f1x_observe", appId, arguments);
+}
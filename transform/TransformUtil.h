@@ -19,17 +19,20 @@
 #pragma once
 
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "clang/AST/AST.h"
+#include "clang/AST/RecursiveASTVisitor.h"
+#include "clang/ASTMatchers/ASTMatchFinder.h"
 #include "clang/Rewrite/Core/Rewriter.h"
 #include "clang/Lex/PPCallbacks.h"
 
 
 #include <rapidjson/document.h>
 
-
-//NOTE: this is a hack to collect ifdef locations from preprocessor
-extern std::shared_ptr<std::vector<clang::SourceRange>> globalConditionalsPP;
+#include "TransformGlobal.h"
 
 // http://stackoverflow.com/questions/19195183/how-to-properly-hash-the-custom-struct
 template <class T>
@@ -69,6 +72,126 @@ namespace std {
   };
 }
 
+/*
+  Preprocessor conditionals (#if ... #endif) of the main file as sorted intervals of file offsets.
+  Checking if a statement partially overlaps with any of them is logarithmic in the number of conditionals:
+  conditionals beginning inside the statement are in a contiguous range of those sorted by begin,
+  and the maximum of their ends is taken from a sparse table (similarly for ends inside the statement).
+ */
+class ConditionalIndex {
+public:
+  /* must be called after preprocessing of the main file */
+  void build(const std::vector<clang::SourceRange> &conditionals, clang::SourceManager &srcMgr);
+  void clear();
+
+  /*
+    Matching situation like this (and the opposite):
+    STMT_BEGIN
+    #ifdef
+    STMT_END
+    #endif
+   */
+  bool intersects(const clang::Stmt *stmt, clang::SourceManager &srcMgr) const;
+
+private:
+  // sparse table of range maximums (or minimums)
+  class RangeTable {
+  public:
+    void build(const std::vector<unsigned> &values, bool maximum);
+    unsigned query(unsigned from, unsigned to) const; // [from, to), non-empty
+  private:
+    bool maximum;
+    std::vector<std::vector<unsigned>> levels;
+  };
+
+  std::vector<unsigned> begins; // sorted
+  std::vector<unsigned> ends;   // sorted
+  RangeTable maxEndByBegin;     // ends of conditionals in the order of begins
+  RangeTable minBeginByEnd;     // begins of conditionals in the order of ends
+};
+
+/*
+  Visible component together with the line where it occurs in its scope (0 for function parameters)
+ */
+struct VisibleComponent {
+  unsigned line;
+  bool inStatement; // occurs in a statement of a compound scope (not a declaration of a function or a global)
+  rapidjson::Value component;
+};
+
+/*
+  Components (variables, members, etc.) visible in scopes of a translation unit.
+  Each scope (compound statement or function) is indexed once together with the lines of its components,
+  so that components visible at a given line are a lookup instead of a traversal of the scope.
+ */
+class ScopeIndex {
+public:
+  ScopeIndex();
+
+  /* appends components of the scope visible at the line (declared at preceding lines) */
+  void collectCompound(const clang::CompoundStmt *scope,
+                       unsigned line,
+                       clang::ASTContext *context,
+                       rapidjson::Document::AllocatorType &allocator,
+                       std::vector<VisibleComponent> &result);
+
+  void collectFunction(const clang::FunctionDecl *scope,
+                       unsigned line,
+                       clang::ASTContext *context,
+                       rapidjson::Document::AllocatorType &allocator,
+                       std::vector<VisibleComponent> &result);
+
+  void clear();
+
+private:
+  struct Entry {
+    unsigned line; // component is visible after this line
+    rapidjson::Value component;
+  };
+
+  struct Scope {
+    bool sortedByLine; // if so, visible components are a prefix
+    std::vector<Entry> entries;
+  };
+
+  rapidjson::Document storage; // owns indexed components
+  std::unordered_map<const clang::CompoundStmt*, Scope> compounds;
+  std::unordered_map<const clang::FunctionDecl*, Scope> functions;
+
+  Scope &getCompound(const clang::CompoundStmt *scope, clang::ASTContext *context);
+  Scope &getFunction(const clang::FunctionDecl *scope, clang::ASTContext *context);
+  void collect(const Scope &scope,
+               unsigned line,
+               bool statements,
+               rapidjson::Document::AllocatorType &allocator,
+               std::vector<VisibleComponent> &result);
+};
+
+/*
+  State of the transformation of a single translation unit.
+  Translation units are transformed concurrently, so handlers must keep everything here instead of globals.
+ */
+struct TransformState {
+  TransformedFile file;
+  unsigned long baseAppId;
+  /*
+    Clang sometimes (for unknown reasons) starts the same file action or matches the same location twice, which causes crashes or invalid results.
+    This is to avoid doing the same twice.
+  */
+  bool alreadyTransformed;
+  std::unordered_set<Location> alreadyMatched;
+  std::shared_ptr<std::vector<clang::SourceRange>> conditionalsPP; // ifdef locations collected by the preprocessor
+  ConditionalIndex conditionalIndex; // built from conditionalsPP before matching
+  rapidjson::Document schemaApplications;
+  ScopeIndex scopeIndex;
+  std::vector<Location> profiledLocations; // position is the index of location in the coverage bitmap of the file
+
+  TransformState(const TransformedFile &file);
+
+  /* forgets results of a failed transformation */
+  void reset();
+};
+
 unsigned getDeclExpandedLine(const clang::Decl *decl, clang::SourceManager &srcMgr);
 
 bool insideMacro(const clang::Stmt *expr, clang::SourceManager &srcMgr, const clang::LangOptions &langOpts);
@@ -82,13 +205,30 @@ private:
   std::shared_ptr<std::vector<clang::SourceRange>> conditionals;
 };
 
-bool intersectConditionalPP(const clang::Stmt* stmt, 
-                            clang::SourceManager &srcMgr, 
-                            const std::shared_ptr<std::vector<clang::SourceRange>> conditions);
 
 
 clang::SourceRange getExpandedLoc(const clang::Stmt *expr, clang::SourceManager &srcMgr);
 
+/*
+  Runs matchers only on statements of the main file that span one of the given (sorted) lines,
+  and does not visit the rest of the AST (e.g. bodies of functions that are not executed by tests).
+  This is cheaper than MatchFinder::matchAST that runs matchers on every node.
+  Used only when a profile is given (command-line mode, see initInterestingLocations).
+ */
+class LineFilteredMatcher : public clang::RecursiveASTVisitor<LineFilteredMatcher> {
+public:
+  LineFilteredMatcher(clang::ast_matchers::MatchFinder &Finder,
+                      clang::ASTContext &Context,
+                      const std::vector<unsigned> &Lines);
+
+  bool TraverseStmt(clang::Stmt *S);
+
+private:
+  clang::ast_matchers::MatchFinder &Finder;
+  clang::ASTContext &Context;
+  const std::vector<unsigned> &Lines;
+};
+
 std::string toString(const clang::Stmt *stmt);
 
 bool overwriteMainChangedFile(clang::Rewriter &TheRewriter);
@@ -114,13 +254,30 @@ rapidjson::Value locToJSON(unsigned fileId, unsigned bl, unsigned bc, unsigned e
                            rapidjson::Document::AllocatorType &allocator);
 
 
+/*
+  Components of the expression followed by visible components ranked by relevance (see cfg.maxComponents)
+ */
 std::vector<rapidjson::Value> collectComponents(const clang::Stmt *stmt,
                                                 unsigned line,
                                                 clang::ASTContext *context,
+                                                ScopeIndex &index,
                                                 rapidjson::Document::AllocatorType &allocator);
 
 
 std::string makeArgumentList(std::vector<rapidjson::Value> &components);
 
+/*
+  Call of the runtime entry point __f1x_eval for the schema application appId.
+  The arrays of arguments (see makeArgumentList) are passed as a single array of pointers,
+  so that call sites do not depend on the search space generated for the application.
+ */
+std::string makeRuntimeCall(unsigned long appId, const std::string &arguments);
+
+/*
+  Call of the runtime entry point __f1x_observe with the same arguments as makeRuntimeCall;
+  it only records values (in the profiling runtime) and returns 0, so the original code is executed
+ */
+std::string makeObservationCall(unsigned long appId, const std::string &arguments);
+
 unsigned long f1xapp(unsigned long baseId, unsigned fileId);
-bool inRange(unsigned line);
+bool inRange(const TransformedFile &file, unsigned line);